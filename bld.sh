@@ -40,7 +40,7 @@ gcc -Wall -g -I $LBM671/include -I $LBM671/include/lbm -L $LBM671/lib -l lbm $LI
     -o linux64_bin/gcsusrc verifymsg.c gcsusrc.c
 
 gcc -Wall -g \
-    -o linux64_bin/gcsmdump gcsmdump.c
+    -o linux64_bin/gcsmdump verifymsg.c gcsmdump.c
 
 gcc -Wall -g \
     -o linux64_bin/gcsmsend gcsmsend.c
@@ -48,6 +48,9 @@ gcc -Wall -g \
 gcc -Wall -g -l m \
     -o linux64_bin/gcsmpong gcsmpong.c
 
+gcc -Wall -g -O2 \
+    -o linux64_bin/gcsbench_verify verifymsg.c gcsbench_verify.c
+
 gcc -Wall -g -I $LBM671/include -I $LBM671/include/lbm -L $LBM671/lib -l lbm $LIBS \
     -o linux64_bin/gcsdumpxml gcsdumpxml.c
 
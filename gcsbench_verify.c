@@ -0,0 +1,438 @@
+/* gcsbench_verify.c */
+/*   Program to benchmark the verifiable message routines in verifymsg.c:
+ * construct and verify throughput for each checksum kernel the CPU can
+ * run, across message sizes, with aligned and unaligned buffers.  Results
+ * are written as JSON so that runs can be compared when the checksum code
+ * changes.  Does not use the LBM library.
+ * See https://github.com/UltraMessaging/gcs_tools
+ *
+ * Authors: The fine folks at 29West/Informatica
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted without restriction.
+ *
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+  THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* use our own form of getopt */
+extern int toptind;
+extern int toptreset;
+extern char *toptarg;
+int tgetopt(int nargc, char * const *nargv, const char *ostr);
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+/* verifymsg.h expects the LBM definition of an iovec; this matches it */
+typedef struct {
+	char *iov_base;
+	size_t iov_len;
+} lbm_iovec_t;
+
+#include "verifymsg.h"
+
+#define MAX_SIZES 64
+#define BUF_ALIGN 64
+
+/* program options (see main() for defaults) */
+int o_duration_ms;
+char *o_kernel = NULL;
+char *o_outfile = NULL;
+int o_quiet;
+size_t o_sizes[MAX_SIZES];
+int o_num_sizes;
+
+const char *default_sizes = "25,64,256,1024,4096,16384,65536,262144,1048576,3000000";
+const char *cksum_kernels[] = { "scalar", "sse2", "avx2", "avx512", NULL };
+const char *crc_kernels[] = { "table", "sse4.2", NULL };
+
+/* program name (from argv[0] */
+char *prog_name = "xxx";
+
+char usage_str[] = "[-d msec] [-h] [-k kernel] [-o outfile] [-q] [-s sizes]";
+void usage(char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+
+	fprintf(stderr, "Usage: %s %s\n\n"
+			"(use -h for detailed help)\n",
+			prog_name, usage_str);
+}  /* usage */
+
+
+void help(char *msg)
+{
+	if (msg != NULL)
+		fprintf(stderr, "\n%s\n\n", msg);
+	fprintf(stderr, "Usage: %s %s\n", prog_name, usage_str);
+	fprintf(stderr, "Where:\n"
+			"  -d msec : time (milliseconds) to run each measurement [200]\n"
+			"  -h : help\n"
+			"  -k kernel : only measure the named kernel (scalar, sse2, avx2, avx512,\n"
+			"              table or sse4.2) [all the CPU supports]\n"
+			"  -o outfile : write the JSON results to outfile [stdout]\n"
+			"  -q : no progress lines on stderr\n"
+			"  -s sizes : comma-separated message sizes in bytes\n"
+			"             [%s]\n", default_sizes);
+}  /* help */
+
+
+/* Monotonic clock in nanoseconds */
+unsigned long long now_ns(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER ticks;
+	static LARGE_INTEGER freq;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&ticks);
+	return (unsigned long long)(ticks.QuadPart / freq.QuadPart) * 1000000000
+		+ (unsigned long long)(ticks.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}  /* now_ns */
+
+
+int parse_sizes(const char *arg)
+{
+	const char *p = arg;
+	char *end;
+
+	o_num_sizes = 0;
+	while (*p != '\0') {
+		if (o_num_sizes >= MAX_SIZES)
+			return -1;
+		o_sizes[o_num_sizes] = (size_t)strtoul(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0'))
+			return -1;
+		o_num_sizes++;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return (o_num_sizes > 0) ? 0 : -1;
+}  /* parse_sizes */
+
+
+#define OP_CONSTRUCT_V1 0
+#define OP_VERIFY_V1 1
+#define OP_CONSTRUCT_V2 2
+#define OP_VERIFY_V2 3
+
+/*
+ * Run one operation on buf repeatedly for about o_duration_ms, doubling the
+ * batch size until a batch is long enough to time.  Returns ns per message.
+ */
+double run_op(int op, char *buf, size_t len, unsigned long long *msgs_out)
+{
+	unsigned long long start, elapsed = 0, msgs = 0, target;
+	unsigned long long batch = 1, i;
+
+	target = (unsigned long long)o_duration_ms * 1000000;
+	/* verify ops check a message built once, up front */
+	if (op == OP_VERIFY_V1)
+		construct_verifiable_msg(buf, len);
+	else if (op == OP_VERIFY_V2)
+		construct_verifiable_msg_v2(buf, len, 0);
+
+	start = now_ns();
+	while (elapsed < target) {
+		for (i = 0; i < batch; i++) {
+			switch (op) {
+			  case OP_CONSTRUCT_V1:
+				construct_verifiable_msg(buf, len);
+				break;
+			  case OP_CONSTRUCT_V2:
+				construct_verifiable_msg_v2(buf, len, msgs + i);
+				break;
+			  default:
+				if (verify_msg(buf, len, 0) != 1) {
+					fprintf(stderr, "ERROR: %lu byte message did not verify\n", (unsigned long)len);
+					exit(1);
+				}
+				break;
+			}
+		}
+		msgs += batch;
+		elapsed = now_ns() - start;
+		if (elapsed < target / 16)
+			batch *= 2;
+	}
+	*msgs_out = msgs;
+	return (double)elapsed / (double)msgs;
+}  /* run_op */
+
+
+int main(int argc, char **argv)
+{
+	static const char *op_names[] = { "construct", "verify", "construct", "verify" };
+	FILE *out = stdout;
+	char *raw_buf;
+	size_t max_size = 0;
+	int opt, s, k, a, op, first = 1;
+
+	prog_name = argv[0];
+
+	/* default option values (declared as module globals) */
+	o_duration_ms = 200;
+	o_kernel = NULL;
+	o_outfile = NULL;
+	o_quiet = 0;
+	parse_sizes(default_sizes);
+
+	while ((opt = tgetopt(argc, argv, "d:hk:o:qs:")) != EOF) {
+		switch (opt) {
+		  case 'd':
+			o_duration_ms = atoi(toptarg);
+			if (o_duration_ms <= 0) {
+				usage("-d must be positive");
+				exit(1);
+			}
+			break;
+		  case 'h':
+			help(NULL);
+			exit(0);
+		  case 'k':
+			o_kernel = toptarg;
+			break;
+		  case 'o':
+			o_outfile = toptarg;
+			break;
+		  case 'q':
+			o_quiet = 1;
+			break;
+		  case 's':
+			if (parse_sizes(toptarg) != 0) {
+				usage("bad size list");
+				exit(1);
+			}
+			break;
+		  default:
+			usage("unrecognized option");
+			exit(1);
+		}
+	}
+	if (toptind != argc) {
+		usage("no positional parameters allowed");
+		exit(1);
+	}
+
+	for (s = 0; s < o_num_sizes; s++) {
+		if (o_sizes[s] < minimum_verifiable_msglen()) {
+			fprintf(stderr, "Size %lu is below the minimum verifiable message length (%lu).\n",
+					(unsigned long)o_sizes[s], (unsigned long)minimum_verifiable_msglen());
+			exit(1);
+		}
+		if (o_sizes[s] > max_size)
+			max_size = o_sizes[s];
+	}
+	raw_buf = malloc(max_size + 2 * BUF_ALIGN);
+	if (raw_buf == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+	verifiable_msg_seed(1);
+
+	if (o_outfile != NULL) {
+		out = fopen(o_outfile, "w");
+		if (out == NULL) {
+			fprintf(stderr, "ERROR: "); perror(o_outfile);
+			exit(1);
+		}
+	}
+
+	fprintf(out, "{\n  \"tool\": \"gcsbench_verify\",\n");
+	fprintf(out, "  \"default_kernels\": { \"inet_cksum\": \"%s\", \"crc32c\": \"%s\" },\n",
+			inet_cksum_kernel(), crc32c_kernel());
+	fprintf(out, "  \"duration_ms\": %d,\n  \"results\": [", o_duration_ms);
+
+	/* v1 messages exercise the inet checksum kernels, v2 the CRC32C kernels */
+	for (op = OP_CONSTRUCT_V1; op <= OP_VERIFY_V2; op++) {
+		const char **kernels = (op <= OP_VERIFY_V1) ? cksum_kernels : crc_kernels;
+
+		for (k = 0; kernels[k] != NULL; k++) {
+			int rc;
+
+			if (o_kernel != NULL && strcmp(o_kernel, kernels[k]) != 0)
+				continue;
+			if (op <= OP_VERIFY_V1)
+				rc = inet_cksum_set_kernel(kernels[k]);
+			else
+				rc = crc32c_set_kernel(kernels[k]);
+			if (rc != 0)
+				continue;	/* not supported on this CPU */
+
+			for (s = 0; s < o_num_sizes; s++) {
+				/* v2 needs room for its header; skip sizes that cannot hold one */
+				if (op >= OP_CONSTRUCT_V2 && o_sizes[s] < minimum_verifiable_msglen_v2())
+					continue;
+				for (a = 1; a >= 0; a--) {
+					/* aligned on a cache line, or one byte past it */
+					char *buf = raw_buf + (BUF_ALIGN - ((size_t)raw_buf % BUF_ALIGN)) + (a ? 0 : 1);
+					unsigned long long msgs;
+					double ns = run_op(op, buf, o_sizes[s], &msgs);
+					double gbps = (double)o_sizes[s] / ns;	/* bytes per ns = GB/s */
+
+					fprintf(out, "%s\n    { \"format\": \"v%d\", \"op\": \"%s\", \"kernel\": \"%s\", "
+							"\"size\": %lu, \"aligned\": %s, \"msgs\": %llu, "
+							"\"ns_per_msg\": %.1f, \"gbytes_per_sec\": %.3f }",
+							first ? "" : ",", (op <= OP_VERIFY_V1) ? 1 : 2, op_names[op], kernels[k],
+							(unsigned long)o_sizes[s], a ? "true" : "false", msgs, ns, gbps);
+					first = 0;
+					if (!o_quiet)
+						fprintf(stderr, "v%d %-9s %-7s %8lu %-9s %12.1f ns/msg %8.3f GB/s\n",
+								(op <= OP_VERIFY_V1) ? 1 : 2, op_names[op], kernels[k],
+								(unsigned long)o_sizes[s], a ? "aligned" : "unaligned", ns, gbps);
+				}
+			}
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+	free(raw_buf);
+	return(0);
+}  /* main */
+
+
+
+/* tgetopt.c - (renamed from BSD getopt) - this source was adapted from BSD
+ *
+ * Copyright (c) 1993, 1994
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *	This product includes software developed by the University of
+ *	California, Berkeley and its contributors.
+ * 4. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef _BSD
+extern char *__progname;
+#else
+#define __progname "tgetopt"
+#endif
+
+int	topterr = 1,		/* if error message should be printed */
+	toptind = 1,		/* index into parent argv vector */
+	toptopt,			/* character checked for validity */
+	toptreset;		/* reset getopt */
+char	*toptarg;		/* argument associated with option */
+
+#define	BADCH	(int)'?'
+#define	BADARG	(int)':'
+#define	EMSG	""
+
+/*
+ * tgetopt --
+ *	Parse argc/argv argument vector.
+ */
+int
+tgetopt(nargc, nargv, ostr)
+	int nargc;
+	char * const *nargv;
+	const char *ostr;
+{
+	static char *place = EMSG;		/* option letter processing */
+	char *oli;				/* option letter list index */
+
+	/* really reset */
+	if (toptreset) {
+		topterr = 1;
+		toptind = 1;
+		toptopt = 0;
+		toptreset = 0;
+		toptarg = NULL;
+		place = EMSG;
+	}
+	if (!*place) {		/* update scanning pointer */
+		if (toptind >= nargc || *(place = nargv[toptind]) != '-') {
+			place = EMSG;
+			return (-1);
+		}
+		if (place[1] && *++place == '-') {	/* found "--" */
+			++toptind;
+			place = EMSG;
+			return (-1);
+		}
+	}					/* option letter okay? */
+	if ((toptopt = (int)*place++) == (int)':' ||
+	    !(oli = strchr(ostr, toptopt))) {
+		/*
+		 * if the user didn't specify '-' as an option,
+		 * assume it means -1.
+		 */
+		if (toptopt == (int)'-')
+			return (-1);
+		if (!*place)
+			++toptind;
+		if (topterr && *ostr != ':')
+			(void)fprintf(stderr,
+			    "%s: illegal option -- %c\n", __progname, toptopt);
+		return (BADCH);
+	}
+	if (*++oli != ':') {			/* don't need argument */
+		toptarg = NULL;
+		if (!*place)
+			++toptind;
+	}
+	else {					/* need an argument */
+		if (*place)			/* no white space */
+			toptarg = place;
+		else if (nargc <= ++toptind) {	/* no arg */
+			place = EMSG;
+			if (*ostr == ':')
+				return (BADARG);
+			if (topterr)
+				(void)fprintf(stderr,
+				    "%s: option requires an argument -- %c\n",
+				    __progname, toptopt);
+			return (BADCH);
+		}
+	 	else				/* white space */
+			toptarg = nargv[toptind];
+		place = EMSG;
+		++toptind;
+	}
+	return (toptopt);			/* dump back option letter */
+}  /* tgetopt */
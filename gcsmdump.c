@@ -77,6 +77,14 @@ typedef unsigned long socklen_t;
 #include <string.h>
 #include <time.h>
 
+/* verifymsg.h expects the LBM definition of an iovec; this matches it */
+typedef struct {
+	char *iov_base;
+	size_t iov_len;
+} lbm_iovec_t;
+
+#include "verifymsg.h"
+
 #define MAXPDU 65536
 
 
@@ -89,6 +97,7 @@ int o_rcvbuf_size;
 int o_pause_ms;
 int o_pause_num;
 int o_verify;
+int o_verify_msgs;
 int o_stop;
 int o_tcp;
 FILE *o_output;
@@ -99,8 +108,15 @@ unsigned long int groupaddr;
 unsigned short int groupport;
 char *bind_if;
 
+/* verifiable message (-V) state */
+verify_stream_t vstream;
+int vstream_framed;
+int num_verified;
+int num_verify_fail;
+int num_not_verifiable;
+
 
-char usage_str[] = "[-h] [-o ofile] [-p pause_ms[/loops]] [-Q Quiet_lvl] [-q] [-r rcvbuf_size] [-s] [-t] [-u] [-v] group port [interface]";
+char usage_str[] = "[-h] [-o ofile] [-p pause_ms[/loops]] [-Q Quiet_lvl] [-q] [-r rcvbuf_size] [-s] [-t] [-u] [-v] [-V] group port [interface]";
 
 void usage(char *msg)
 {
@@ -132,6 +148,8 @@ void help(char *msg)
 			"  -s : stop execution when status msg received\n"
 			"  -t : Use TCP (use '0.0.0.0' for group)\n"
 			"  -v : verify the sequence numbers\n"
+			"  -V : verify verifiable messages (from the -V option of the LBM tools);\n"
+			"       with -t the stream must hold back-to-back version 2 or 3 messages\n"
 			"\n"
 			"  group : multicast address to receive (required, use '0.0.0.0' for unicast)\n"
 			"  port : destination port (required)\n"
@@ -226,6 +244,47 @@ void currenttv(struct timeval *tv)
 }  /* currenttv */
 
 
+void print_verify_counts(FILE *ofile)
+{
+	fprintf(ofile, "%d msgs verified, %d failed verification, %d not verifiable\n",
+			num_verified, num_verify_fail, num_not_verifiable);
+	fflush(ofile);
+}  /* print_verify_counts */
+
+
+void count_verify_result(int rc)
+{
+	if (rc == 1)
+		num_verified++;
+	else if (rc == 0)
+		num_verify_fail++;
+	else
+		num_not_verifiable++;
+}  /* count_verify_result */
+
+
+/* TCP has no message boundaries; the v2 or v3 header's length supplies them.
+ * Each recv() chunk is checksummed where it lies, with no reassembly. */
+void verify_tcp_chunk(const char *buffer, int size)
+{
+	size_t used = 0;
+
+	while (vstream_framed && used < (size_t)size) {
+		used += verify_stream_update(&vstream, buffer + used, (size_t)size - used);
+		if (verify_stream_complete(&vstream)) {
+			count_verify_result(verify_stream_final(&vstream, 0, NULL));
+			verify_stream_init(&vstream);
+		} else if (vstream.version == 1 || vstream.version == -1) {
+			printf("ERROR: TCP stream is not version 2 or 3 verifiable messages, verification stopped\n");
+			fflush(stdout);
+			if (o_output) { fprintf(o_output, "ERROR: TCP stream is not version 2 or 3 verifiable messages, verification stopped\n"); fflush(o_output); }
+			num_not_verifiable++;
+			vstream_framed = 0;
+		}
+	}
+}  /* verify_tcp_chunk */
+
+
 int main(int argc, char **argv)
 {
 	int opt;
@@ -282,6 +341,7 @@ int main(int argc, char **argv)
 	o_pause_ms = 0;
 	o_pause_num = 0;
 	o_verify = 0;
+	o_verify_msgs = 0;
 	o_stop = 0;
 	o_tcp = 0;
 	o_output = NULL;
@@ -290,7 +350,7 @@ int main(int argc, char **argv)
 	/* default values for optional positional params */
 	bind_if = NULL;
 
-	while ((opt = tgetopt(argc, argv, "hqQ:p:r:o:vst")) != EOF) {
+	while ((opt = tgetopt(argc, argv, "hqQ:p:r:o:vVst")) != EOF) {
 		switch (opt) {
 		  case 'h':
 			help(NULL);  exit(0);
@@ -315,6 +375,9 @@ int main(int argc, char **argv)
 		  case 'v':
 			o_verify = 1;
 			break;
+		  case 'V':
+			o_verify_msgs = 1;
+			break;
 		  case 's':
 			o_stop = 1;
 			break;
@@ -346,11 +409,12 @@ int main(int argc, char **argv)
 	if (num_parms == 2) {
 		groupaddr = inet_addr(argv[toptind]);
 		groupport = (unsigned short)atoi(argv[toptind+1]);
-		sprintf(equiv_cmd, "mdump %s-p%d -Q%d -r%d %s%s%s%s %s",
+		sprintf(equiv_cmd, "mdump %s-p%d -Q%d -r%d %s%s%s%s%s %s",
 				o_output_equiv_opt, o_pause_ms, o_quiet_lvl, o_rcvbuf_size,
 				o_stop ? "-s " : "",
 				o_tcp ? "-t " : "",
 				o_verify ? "-v " : "",
+				o_verify_msgs ? "-V " : "",
 				argv[toptind],argv[toptind+1]);
 		printf("Equiv cmd line: %s\n", equiv_cmd); fflush(stdout);
 		if (o_output) { fprintf(o_output, "Equiv cmd line: %s\n", equiv_cmd); fflush(o_output); }
@@ -358,11 +422,12 @@ int main(int argc, char **argv)
 		groupaddr = inet_addr(argv[toptind]);
 		groupport = (unsigned short)atoi(argv[toptind+1]);
 		bind_if  = argv[toptind+2];
-		sprintf(equiv_cmd, "mdump %s-p%d -Q%d -r%d %s%s%s%s %s %s",
+		sprintf(equiv_cmd, "mdump %s-p%d -Q%d -r%d %s%s%s%s%s %s %s",
 				o_output_equiv_opt, o_pause_ms, o_quiet_lvl, o_rcvbuf_size,
 				o_stop ? "-s " : "",
 				o_tcp ? "-t " : "",
 				o_verify ? "-v " : "",
+				o_verify_msgs ? "-V " : "",
 				argv[toptind],argv[toptind+1],argv[toptind+2]);
 		printf("Equiv cmd line: %s\n", equiv_cmd); fflush(stdout);
 		if (o_output) { fprintf(o_output, "Equiv cmd line: %s\n", equiv_cmd); fflush(o_output); }
@@ -460,12 +525,20 @@ int main(int argc, char **argv)
 
 	cur_seq = 0;
 	num_rcvd = 0;
+	verify_stream_init(&vstream);
+	vstream_framed = 1;
 	for (;;) {
 		if (o_tcp) {
 			cur_size = recv(sock,buff,65536,0);
 			if (cur_size == 0) {
 				printf("EOF\n");
 				if (o_output) { fprintf(o_output, "EOF\n"); }
+				if (o_verify_msgs) {
+					if (vstream_framed && vstream.offset > 0)
+						count_verify_result(verify_stream_final(&vstream, 0, NULL));  /* truncated */
+					print_verify_counts(stdout);
+					if (o_output) print_verify_counts(o_output);
+				}
 				break;
 			}
 		} else {
@@ -504,6 +577,13 @@ int main(int argc, char **argv)
 			}
 		}
 
+		if (o_tcp && o_verify_msgs) {
+			/* the stream is verifiable messages, not commands */
+			verify_tcp_chunk(buff, cur_size);
+			++num_rcvd;
+			continue;
+		}
+
 		if (cur_size > 5 && memcmp(buff, "echo ", 5) == 0) {
 			/* echo command */
 			buff[cur_size] = '\0';  /* guarantee trailing null */
@@ -515,6 +595,7 @@ int main(int argc, char **argv)
 			/* reset stats */
 			num_rcvd = 0;
 			cur_seq = 0;
+			num_verified = num_verify_fail = num_not_verifiable = 0;
 		}
 		else if (cur_size > 5 && memcmp(buff, "stat ", 5) == 0) {
 			/* when sender tells us to, calc and print stats */
@@ -530,6 +611,10 @@ int main(int argc, char **argv)
 				fprintf(o_output, "%f%% loss\n", perc_loss);
 				fflush(o_output);
 			}
+			if (o_verify_msgs) {
+				print_verify_counts(stdout);
+				if (o_output) print_verify_counts(o_output);
+			}
 
 			if (o_stop)
 				exit(0);
@@ -537,6 +622,7 @@ int main(int argc, char **argv)
 			/* reset stats */
 			num_rcvd = 0;
 			cur_seq = 0;
+			num_verified = num_verify_fail = num_not_verifiable = 0;
 		}
 		else {  /* not a cmd */
 			if (o_pause_ms > 0 && ( (o_pause_num > 0 && num_rcvd < o_pause_num)
@@ -544,6 +630,9 @@ int main(int argc, char **argv)
 				SLEEP_MSEC(o_pause_ms);
 			}
 
+			if (o_verify_msgs)
+				count_verify_result(verify_msg(buff, cur_size, 0));
+
 			if (o_verify) {
 				buff[cur_size] = '\0';  /* guarantee trailing null */
 				if (cur_seq != strtol(&buff[8], NULL, 16)) {
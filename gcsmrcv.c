@@ -56,6 +56,7 @@
 #include <lbm/lbm.h>
 #include <lbm/lbmmon.h>
 #include "monmodopts.h"
+#include "verifymsg.h"
 #include "lbm-example-util.h"
 
 
@@ -98,11 +99,12 @@ const char Usage[] =
 "  -R, --receivers=NUM      create NUM receivers\n"
 "  -s, --statistics         print statistics along with bandwidth\n"
 "  -v, --verbose            be verbose\n"
+"  -V, --verify             verify message contents, with one verifier per context\n"
 "  -X, --xml-config=FILE     Use UM XML configuration FILE\n"
 "  -Y, --xml-appname=APP     Use UM XML APP application name\n"
 ;
 
-const char * OptionString = "B:c:C:Ee:hi:o:L:r:R:svX:Y:";
+const char * OptionString = "B:c:C:Ee:hi:o:L:r:R:svVX:Y:";
 const struct option OptionTable[] =
 {
 	{ "bufsize", required_argument, NULL, 'B' },
@@ -117,6 +119,7 @@ const struct option OptionTable[] =
 	{ "receivers", required_argument, NULL, 'R' },
 	{ "statistics", no_argument, NULL, 's' },
 	{ "verbose", no_argument, NULL, 'v' },
+	{ "verify", no_argument, NULL, 'V' },
 	{ "xml-config", required_argument, NULL, 'X' },
 	{ "xml-appname", required_argument, NULL, 'Y' },
 	{ "context-stats", no_argument, NULL, OPTION_CONTEXT_STATS },
@@ -148,6 +151,7 @@ struct Options {
 	int regid_offset;   	/* Offset for calculating registration IDs */
 	char topicroot[80];
 	int verbose;
+	int verify_msgs;	/* Flag to use message verification (verifymsg.h) */
 	char xml_config[256];	/* XML Configuration file */
 	char xml_appname[256];	/* Application name reference in the XML file */
 	int context_stats;	/* Flag to include context stats */
@@ -167,6 +171,17 @@ lbm_ulong_t lost = 0, last_lost = 0;
 lbm_rcv_transport_stats_t * stats = NULL;
 int nstats = DEFAULT_NUM_SRCS;
 
+/*
+ * Verification state for one context, passed to its receivers as clientd.
+ * A context delivers on its own thread, so each verifier is only ever used
+ * by one thread and needs no locking.
+ */
+struct ctx_verify {
+	verifier_ctx_t *vctx;
+	int verify_fail_count;		/* Running total; main thread reports the change */
+};
+struct ctx_verify ctx_verifiers[MAX_NUM_CTXS];
+
 /*
  * For the elapsed time, calculate and print the msgs/sec and bits/sec as well
  * as any unrecoverable data.
@@ -339,6 +354,7 @@ lbm_uint_t ume_rcv_regid_ex(lbm_ume_rcv_regid_ex_func_info_t *info, void *client
 int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 {
 	struct Options *opts = &options;
+	struct ctx_verify *cv = (struct ctx_verify *) clientd;
 	
 	switch (msg->type) {
 	case LBM_MSG_DATA:
@@ -360,6 +376,20 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 		}
 		if(msg->flags & LBM_MSG_FLAG_RETRANSMIT) rxs++;
 		if(msg->flags & LBM_MSG_FLAG_OTR) otrs++;
+		if (opts->verify_msgs) {
+			int rc = verify_msg_r(cv->vctx, msg->data, msg->len, opts->verbose > 1, NULL);
+			if (rc == 0) {
+				printf("[%s][%s] Message sqn %x does not verify!\n",
+					   msg->topic_name, msg->source, msg->sequence_number);
+				print_verify_bad_ranges(stdout, msg->data, msg->len);
+				cv->verify_fail_count++;
+			} else if (rc == -1) {
+				fprintf(stderr, "[%s][%s] Message sqn %x is not a verifiable message.\n",
+					   msg->topic_name, msg->source, msg->sequence_number);
+				fprintf(stderr, "Use -V option on source and restart receiver.\n");
+				exit(1);
+			}
+		}
 		break;
 	case LBM_MSG_BOS:
 			printf("[%s][%s], Beginning of Transport Session\n", msg->topic_name, msg->source);
@@ -537,6 +567,9 @@ void process_cmdline(int argc, char **argv) {
 			case 'v':
 				opts->verbose++;
 				break;
+			case 'V':
+				opts->verify_msgs = 1;
+				break;
 			case 'X':
 				if (optarg != NULL) {
 					strncpy(opts->xml_config, optarg, (sizeof(opts->xml_config)-1));
@@ -649,6 +682,7 @@ int main(int argc, char **argv)
 	int ctxidx = 0;
 	FILE *end_flg_fp = NULL;
 	lbm_ulong_t lost_tmp;
+	int verify_fails = 0, last_verify_fails = 0;
 	char * xml_config_env_check = NULL;
 	
 #if defined(_WIN32)
@@ -740,6 +774,18 @@ int main(int argc, char **argv)
 	/* After a context gets created, the attributes can be discarded */
 	lbm_context_attr_delete(cattr);;
 
+	/* Give each context its own verifier so they can check messages in parallel */
+	if (opts->verify_msgs) {
+		for (i = 0; i < opts->num_ctxs; i++) {
+			if ((ctx_verifiers[i].vctx = verifier_ctx_create()) == NULL) {
+				fprintf(stderr, "could not allocate verifier context\n");
+				exit(1);
+			}
+		}
+		printf("Verifying messages with the %s checksum and %s CRC32C kernels.\n",
+			inet_cksum_kernel(), crc32c_kernel());
+	}
+
 	if ((rcvs = malloc(sizeof(lbm_rcv_t *) * MAX_NUM_RCVS)) == NULL) {
 		fprintf(stderr, "could not allocate receivers array\n");
 		exit(1);
@@ -791,7 +837,7 @@ int main(int argc, char **argv)
 		 * Create receiver passing in the looked up topic info.
 		 * We use the same callback function for data received.
 		 */
-		if (lbm_rcv_create(&(rcvs[i]), ctxs[ctxidx], topic, rcv_handle_msg, NULL, evq) 
+		if (lbm_rcv_create(&(rcvs[i]), ctxs[ctxidx], topic, rcv_handle_msg, &ctx_verifiers[ctxidx], evq) 
 						   == LBM_FAILURE) {
 			fprintf(stderr, "lbm_rcv_create: %s\n", lbm_errmsg());
 			exit(1);
@@ -839,6 +885,13 @@ int main(int argc, char **argv)
 		normalize_tv(&endtv);
 
 		print_bw(stdout, &endtv, msg_count, byte_count, unrec_count, lost, rxs, otrs);
+		if (opts->verify_msgs) {
+			for (verify_fails = 0, i = 0; i < opts->num_ctxs; i++)
+				verify_fails += ctx_verifiers[i].verify_fail_count;
+			if (verify_fails != last_verify_fails)
+				printf("  %d msgs failed verification\n", verify_fails - last_verify_fails);
+			last_verify_fails = verify_fails;
+		}
 		
 		msg_count = 0;
 		byte_count = 0;
@@ -880,12 +933,17 @@ int main(int argc, char **argv)
 	for (i = 0; i < opts->num_ctxs; i++) {
 		lbm_context_delete(ctxs[i]);
 		ctxs[i] = NULL;
+		verifier_ctx_delete(ctx_verifiers[i].vctx);
+		ctx_verifiers[i].vctx = NULL;
 	}
 	free(rcvs);
 	printf("Quitting.... received %u messages", total_msg_count);
 	if (total_unrec_count > 0 || total_burst_loss > 0) {
 		printf(", %u msgs unrecovered, %u loss bursts", total_unrec_count, total_burst_loss);
 	}
+	if (verify_fails > 0) {
+		printf(", %d msgs failed verification", verify_fails);
+	}
 	printf("\n");
 	return 0;
 }
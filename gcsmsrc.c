@@ -61,6 +61,7 @@
 #include <lbm/lbmmon.h>
 #include "monmodopts.h"
 #include "lbm-example-util.h"
+#include "verifymsg.h"
 
 
 #if defined(_WIN32)
@@ -92,10 +93,23 @@ const char Usage[] =
 "                            Example:  '-c file1.cfg -c file2.cfg'\n"
 "                            NOTE: For XML config files, use the -X and -Y options\n"
 "  -d, --delay=NUM           delay sending for delay seconds after source creation\n"
+"      --wait-receivers=N[,SECS]\n"
+"                            instead of -d, start sending as soon as there are N\n"
+"                            receiver connections across all of the sources (e.g.\n"
+"                            sources x receivers), and report how long that took;\n"
+"                            exit if it takes more than SECS seconds\n"
 "  -h, --help                display this help and exit\n"
 "  -i, --initial-topic=NUM   use NUM as initial topic number [0]\n"
 "  -j, --late-join=NUM       enable Late Join with specified retention buffer size (in bytes)\n"
 "  -l, --length=NUM          send messages of length NUM bytes\n"
+"      --size-dist=SPEC      draw message sizes from a distribution instead of -l,\n"
+"                            where SPEC is one of:\n"
+"                              SIZE:WEIGHT,... (fixed sizes, weighted)\n"
+"                              uniform:MIN,MAX\n"
+"                              lognormal:MEDIAN,SIGMA[,MAX] (MAX default 65536)\n"
+"                              file:PATH (\"SIZE WEIGHT\" lines, e.g. a histogram)\n"
+"                            sizes are drawn before the run; the send rates are\n"
+"                            reported overall and per power of 2 size range\n"
 "  -L, --linger=NUM          linger for NUM seconds after done\n"
 "  -M, --messages=NUM        send maximum of NUM messages\n"
 "  -P, --pause=NUM           pause NUM milliseconds after each send\n"
@@ -110,12 +124,18 @@ const char Usage[] =
 "  -S, --sources=NUM         use NUM sources\n"
 "  -T, --threads=NUM         use NUM threads\n"
 "  -v, --verbose             be verbose\n"
+"  -V, --verifiable          construct verifiable messages\n"
+"      --block-checksums     with -V, checksum each 4 KB block of the message so\n"
+"                            a receiver can report which byte ranges are damaged\n"
 "  -X, --xml-config=FILE     Use UM XML configuration FILE\n"
 "  -Y, --xml-appname=APP     Use UM XML APP application name\n"
 ;
 
-const char * OptionString = "b:c:d:hi:j:l:L:M:P:r:R:s:S:T:vX:Y:";
+const char * OptionString = "b:c:d:hi:j:l:L:M:P:r:R:s:S:T:vVX:Y:";
 #define OPTION_CONTEXT_STATS 1
+#define OPTION_BLOCK_CHECKSUMS 2
+#define OPTION_SIZE_DIST 3
+#define OPTION_WAIT_RECEIVERS 4
 const struct option OptionTable[] =
 {
 	{ "batch", required_argument, NULL, 'b' },
@@ -134,9 +154,13 @@ const struct option OptionTable[] =
 	{ "sources", required_argument, NULL, 'S' },
 	{ "threads", required_argument, NULL, 'T' },
 	{ "verbose", no_argument, NULL, 'v' },
+	{ "verifiable", no_argument, NULL, 'V' },
 	{ "xml-config", required_argument, NULL, 'X' },
 	{ "xml-appname", required_argument, NULL, 'Y' },
 	{ "context-stats", no_argument, NULL, OPTION_CONTEXT_STATS },
+	{ "block-checksums", no_argument, NULL, OPTION_BLOCK_CHECKSUMS },
+	{ "size-dist", required_argument, NULL, OPTION_SIZE_DIST },
+	{ "wait-receivers", required_argument, NULL, OPTION_WAIT_RECEIVERS },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -150,9 +174,14 @@ const struct option OptionTable[] =
 #define DEFAULT_LINGER_SECONDS 1
 #define DEFAULT_INITIAL_TOPIC_NUMBER 0
 #define DEFAULT_MAX_NUM_TRANSPORTS 100
+#define SIZE_DIST_RING_SLOTS 256	/* Verifiable messages built per thread for --size-dist */
 
 struct Options {
 	int context_stats;	/* Flag to include context stats */
+	int verifiable_msgs;	/* Flag to send verifiable messages (verifymsg.h) */
+	int block_checksums;	/* Flag to use the block checksum layout for -V */
+	char *size_dist_spec;	/* Message size distribution (--size-dist) */
+	rcv_wait_t rcv_wait;	/* Receiver connections to wait for in place of -d */
 	char xml_config[256];	/* XML Configuration file */
 	char xml_appname[256]; 	/* Application name reference in the XML file */
 } options;
@@ -161,6 +190,7 @@ struct Options *opts = &options;
 /* global options */
 int verbose = 0;
 int delay = 1;
+volatile int rcvs_connected = 0;	/* Receiver connections, across all sources */
 
 /* Source event handler (passed into lbm_src_create()) */
 int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
@@ -176,6 +206,7 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 
 			if (verbose)
 				printf("Receiver connect [%s]\n",clientname);
+			rcvs_connected++;
 		}
 		break;
 	case LBM_SRC_EVENT_DISCONNECT:
@@ -188,6 +219,7 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 
 			if (verbose)
 				printf("Receiver disconnect [%s]\n",clientname);
+			rcvs_connected--;
 		}
 		break;
 	default:
@@ -199,6 +231,7 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 
 lbm_event_queue_t *evq = NULL;
 lbm_src_t **srcs = NULL;
+lbm_uint64_t *src_seqs = NULL;	/* Next sequence number for each source (only its thread touches it) */
 size_t msglen = MIN_ALLOC_MSGLEN;
 int num_thrds = DEFAULT_NUM_THREADS;
 int num_srcs = DEFAULT_NUM_SRCS;
@@ -206,6 +239,7 @@ int totalmsgsleft = DEFAULT_MAX_MESSAGES;
 int msecpause = 0;
 int batchsz = 1;
 int stats_timer_id = -1, done_sending = 0;
+size_dist_t size_dist;		/* Pre-sampled --size-dist sizes (msglen is the largest) */
 lbm_ulong_t stats_sec = 0;
 
 /* Print transport statistics */
@@ -300,10 +334,14 @@ int handle_stats_timer(lbm_context_t *ctx, const void *clientd)
 #  define MAX_NUM_THREADS 16
 int thrdidxs[MAX_NUM_THREADS];
 int msgsleft[MAX_NUM_THREADS];
+verifiable_ring_t rings[MAX_NUM_THREADS];	/* -V: each thread's messages, stamped per send */
+size_stats_t size_stats[MAX_NUM_THREADS];	/* Sent by size, copied out as each thread ends */
 #else
 #  define MAX_NUM_THREADS 16
 int thrdidxs[MAX_NUM_THREADS];
 int msgsleft[MAX_NUM_THREADS];
+verifiable_ring_t rings[MAX_NUM_THREADS];	/* -V: each thread's messages, stamped per send */
+size_stats_t size_stats[MAX_NUM_THREADS];	/* Sent by size, copied out as each thread ends */
 #endif /* _WIN32 */
 
 /*
@@ -317,7 +355,9 @@ void *sending_thread_main(void *arg)
 {
 	int i = 0, thrdidx = *((int *)arg);
 	int n = 0;
+	lbm_uint64_t draws = 0;	/* --size-dist samples taken by this thread */
 	char *message = NULL;
+	size_stats_t sizes;	/* updated locally, off the other threads' cache lines */
 
 #if defined(_WIN32)
 	if (thrdidx > 0) {
@@ -325,7 +365,7 @@ void *sending_thread_main(void *arg)
 		lbm_win32_static_thread_attach();
 	}
 #endif /* _WIN32 */
-	/* if message buffer is too small, then the sprintf will cause issues. So, allocate with a min size */
+	/* allocate at least a whole message template (see msg_template_init()) */
 	if (msglen < MIN_ALLOC_MSGLEN) {
 		message = malloc(MIN_ALLOC_MSGLEN);
 	} else {
@@ -335,18 +375,30 @@ void *sending_thread_main(void *arg)
 		fprintf(stderr, "could not allocate message buffer of size %u bytes\n",(unsigned int)msglen);
 		exit(1);
 	}
-	memset(message, 0, msglen);
-
+	msg_template_init(message, msglen);
+	memset(&sizes, 0, sizeof(sizes));
 	/*
 	 * Send to each source in turn until we have sent the max number
 	 * of messages total.
 	 */
 	while (msgsleft[thrdidx] > 0) {
 		for (i = thrdidx; i < num_srcs; i += num_thrds) {
-			if (lbm_src_send(srcs[i], message, msglen, 0) == LBM_FAILURE) {
+			const char *sendp = message;
+			size_t len = msglen;
+
+			if (size_dist.sizes != NULL)
+				len = SIZE_DIST_NEXT(&size_dist, draws++);
+			if (opts->verifiable_msgs)
+				sendp = verifiable_ring_next(&rings[thrdidx], &len, src_seqs[i]);
+			else
+				MSG_TEMPLATE_SET_SEQ(message, len, src_seqs[i]);
+			src_seqs[i]++;
+			if (lbm_src_send(srcs[i], sendp, len, 0) == LBM_FAILURE) {
 				fprintf(stderr, "lbm_src_send: %s\n", lbm_errmsg());
 				exit(1);
 			}
+			if (size_dist.sizes != NULL)
+				size_stats_add(&sizes, len);
 			n++;
 			if (--msgsleft[thrdidx] == 0)
 				break;
@@ -357,6 +409,7 @@ void *sending_thread_main(void *arg)
 		}
 	}
 	free(message);
+	size_stats[thrdidx] = sizes;
 #if defined(_WIN32)
 	if (thrdidx > 0) {
 		/* The following line is only needed for static Windows library use */
@@ -385,6 +438,7 @@ int main(int argc, char **argv)
 	lbm_uint64_t rm_rate = 0, rm_retrans = 0;
 	char rm_protocol = 'M';
 	char * xml_config_env_check = NULL;
+	struct timeval starttv, endtv;
 #if defined(_WIN32)
 	HANDLE wthrdh[MAX_NUM_THREADS];
 	DWORD wthrdids[MAX_NUM_THREADS];
@@ -482,6 +536,9 @@ int main(int argc, char **argv)
 			case 'v':
 				verbose++;
 				break;
+			case 'V':
+				opts->verifiable_msgs = 1;
+				break;
 			case 'X':
 				if (optarg != NULL) {
 					strncpy(opts->xml_config, optarg, (sizeof(opts->xml_config)-1));
@@ -501,6 +558,18 @@ int main(int argc, char **argv)
 			case OPTION_CONTEXT_STATS:
 				opts->context_stats = 1;
 				break;
+			case OPTION_BLOCK_CHECKSUMS:
+				opts->block_checksums = 1;
+				break;
+			case OPTION_WAIT_RECEIVERS:
+				if (rcv_wait_parse(optarg, &opts->rcv_wait) != 0) {
+					fprintf(stderr, "bad --wait-receivers '%s'\n", optarg);
+					errflag++;
+				}
+				break;
+			case OPTION_SIZE_DIST:
+				opts->size_dist_spec = optarg;
+				break;
 			default:
 				errflag++;
 				break;
@@ -512,6 +581,33 @@ int main(int argc, char **argv)
 		fprintf(stderr, Usage, argv[0]);
 		exit(1);
 	}
+	if (opts->block_checksums && !opts->verifiable_msgs) {
+		fprintf(stderr, "--block-checksums requires -V\n");
+		exit(1);
+	}
+	if (opts->block_checksums && opts->size_dist_spec != NULL) {
+		fprintf(stderr, "--block-checksums cannot be used with --size-dist\n");
+		exit(1);
+	}
+	/* With --size-dist, the largest size takes the place of -l */
+	if (opts->size_dist_spec != NULL) {
+		size_t min_msglen = opts->verifiable_msgs ? minimum_verifiable_msglen_v2() : 1;
+
+		if (size_dist_create(&size_dist, opts->size_dist_spec, min_msglen, (lbm_uint64_t) time(NULL)) != 0)
+			exit(1);
+		if (size_dist.raised > 0)
+			printf("%u of %u sampled sizes raised to the verifiable minimum (%u).\n",
+				size_dist.raised, SIZE_DIST_SAMPLES, (unsigned int)min_msglen);
+		msglen = size_dist.max;
+	}
+	if (opts->verifiable_msgs) {
+		size_t min_msglen = opts->block_checksums ? minimum_verifiable_msglen_blocks() : minimum_verifiable_msglen_v2();
+
+		if (msglen < min_msglen) {
+			fprintf(stderr, "Verifiable messages must be at least %u bytes (-l).\n", (unsigned int)min_msglen);
+			exit(1);
+		}
+	}
 	if (num_thrds > num_srcs) {
 		fprintf(stderr, "Number of threads must be less than or equal to number of sources.\n");
 		exit(1);
@@ -630,9 +726,14 @@ int main(int argc, char **argv)
 		fprintf(stderr, "could not allocate sources array\n");
 		exit(1);
 	}
+	if ((src_seqs = calloc(num_srcs, sizeof(lbm_uint64_t))) == NULL) {
+		fprintf(stderr, "could not allocate source sequence numbers\n");
+		exit(1);
+	}
 
 	/* Create all the sources */
 	printf("Creating %d sources\n", num_srcs);
+	rcv_wait_start(&opts->rcv_wait);
 	for (i = 0; i < num_srcs; i++) {
 		/* If create LOTS of srcs at full speed, it's pretty hard
 		 * on topic resolution.  Space it out just a little bit. */
@@ -660,14 +761,52 @@ int main(int argc, char **argv)
 	}
 	lbm_src_topic_attr_delete(tattr);
 
-	if (delay > 0) {
+	if (opts->rcv_wait.needed > 0) {
+		printf("Waiting for %d receiver connection%s...\n", opts->rcv_wait.needed,
+			(opts->rcv_wait.needed > 1) ? "s" : "");
+		if (rcv_wait_for(&opts->rcv_wait, &rcvs_connected) != 0) {
+			fprintf(stderr, "Timed out after %d seconds waiting for receivers (%d of %d connections)\n",
+				opts->rcv_wait.timeout_sec, rcvs_connected, opts->rcv_wait.needed);
+			exit(1);
+		}
+		rcv_wait_print(stdout, &opts->rcv_wait, "receiver connections");
+	} else if (delay > 0) {
 		printf("Delaying sending for %d second%s...\n", delay, ((delay > 1) ? "s" : ""));
 		SLEEP_SEC(delay);
 	}
 	printf("Created %d Sources. Will start sending data now.\n",num_srcs);
 
-	printf("Using %d threads to send %u messages of size %u bytes (%u messages per thread).\n",
-		   num_thrds, totalmsgsleft, (unsigned int)msglen, totalmsgsleft / num_thrds);
+	if (size_dist.sizes != NULL) {
+		printf("Using %d threads to send %u messages of %u to %u bytes, mean %.1f (%u messages per thread).\n",
+			   num_thrds, totalmsgsleft, (unsigned int)size_dist.min, (unsigned int)size_dist.max,
+			   size_dist.mean, totalmsgsleft / num_thrds);
+	} else {
+		printf("Using %d threads to send %u messages of size %u bytes (%u messages per thread).\n",
+			   num_thrds, totalmsgsleft, (unsigned int)msglen, totalmsgsleft / num_thrds);
+	}
+	/*
+	 * Build each thread's verifiable messages here; the ring is built with
+	 * the shared generator, which is not thread safe.  With --size-dist each
+	 * thread takes a different stretch of the sampled sizes, otherwise it
+	 * gets a single slot.  Every send restamps its sequence and timestamp.
+	 */
+	if (opts->verifiable_msgs) {
+		for (i = 0; i < num_thrds; i++) {
+			int rc;
+
+			if (size_dist.sizes != NULL)
+				rc = verifiable_ring_create(&rings[i], SIZE_DIST_RING_SLOTS,
+						size_dist.sizes + (size_t)i * SIZE_DIST_RING_SLOTS, SIZE_DIST_RING_SLOTS, 2, 0);
+			else
+				rc = verifiable_ring_create(&rings[i], 1, &msglen, 1,
+						(opts->block_checksums ? 3 : 2), 0);
+			if (rc != 0) {
+				fprintf(stderr, "could not build ring of verifiable messages\n");
+				exit(1);
+			}
+		}
+	}
+	current_tv(&starttv);
 
 	/* Divide sending load amongst available threads */
 	for (i = 1; i < num_thrds; i++) {
@@ -716,6 +855,18 @@ int main(int argc, char **argv)
 #endif /* _WIN32 */
 	}
 	done_sending = 1;
+	current_tv(&endtv);
+	endtv.tv_sec -= starttv.tv_sec;
+	endtv.tv_usec -= starttv.tv_usec;
+	normalize_tv(&endtv);
+	if (size_dist.sizes != NULL) {
+		double secs = (double)endtv.tv_sec + (double)endtv.tv_usec / 1000000.0;
+
+		for (i = 1; i < num_thrds; i++)
+			size_stats_merge(&size_stats[0], &size_stats[i]);
+		printf("Sending took %.04g seconds.\n", secs);
+		size_stats_print(stdout, &size_stats[0], secs);
+	}
 
 	/* we do this before the linger, so some things may be in batching, etc. and not show up in stats. */
 	handle_stats_timer(ctx, ctx);
@@ -739,6 +890,10 @@ int main(int argc, char **argv)
 
 	/* Free the source array and message buffer used for sending */
 	free(srcs);
+	free(src_seqs);
+	for (i = 0; i < num_thrds; i++)
+		verifiable_ring_delete(&rings[i]);
+	size_dist_delete(&size_dist);
 	return 0;
 }
 
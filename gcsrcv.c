@@ -24,6 +24,9 @@
 #define _POSIX_C_SOURCE 200112L
 #include <sys/time.h>
 #endif
+#if defined(__linux__)
+#define _GNU_SOURCE	/* for pthread_setaffinity_np() */
+#endif
 #if defined(__TANDEM) && defined(HAVE_TANDEM_SPT)
 	#include <ktdmtyp.h>
 	#include <spthread.h>
@@ -43,8 +46,16 @@
 	#include <arpa/inet.h>
 	#include <signal.h>
 	#include <sys/time.h>
+	#include <sched.h>
 	#if defined(__TANDEM)
 		#include <strings.h>
+		#if defined(HAVE_TANDEM_SPT)
+			#include <spthread.h>
+		#else
+			#include <pthread.h>
+		#endif
+	#else
+		#include <pthread.h>
 	#endif
 #endif
 #include <lbm/lbm.h>
@@ -92,9 +103,22 @@ const char usage[] =
 "      --context-stats    include context stats with -s option\n"
 "  --max-sources=NUM      allow up to NUM sources (for statistics gathering purposes)\n"
 "  -S, --stop             exit when source stops sending, and print throughput summary\n"
+"      --warmup=NUM|TIME  leave the first NUM messages, or the first TIME after the\n"
+"                         first message (e.g. '2s' or '500ms'), out of the summary\n"
+"      --windows=NUM[,SECS]\n"
+"                         after any warm-up, measure NUM windows of SECS seconds [1]\n"
+"                         each, report their rates and whether the run reached\n"
+"                         steady state, then exit\n"
+"      --steady-cv=PCT    with --windows, the run is steady once the window rates'\n"
+"                         coefficient of variation stays at or below PCT percent [5]\n"
 "  -U, --losslev=NUM      exit after NUM% unrecoverable loss\n"
 "  -v, --verbose          be verbose about incoming messages (-v -v = be even more verbose)\n"
-"  -V, --verify           verify message contents\n"
+"  -V, --verify           verify message contents; for version 2 messages, also\n"
+"                         report sequence gaps and one-way latency each second\n"
+"      --verify-threads=NUM\n"
+"                         with -V, verify on NUM worker threads instead of in the\n"
+"                         receive callback (up to 16)\n"
+"      --verify-cpus=LIST pin the verify threads to the comma-separated CPUs in LIST\n"
 "  -X, --xml-config=FILE  Use UM XML configuration FILE\n"
 "  -Y, --xml-appname=APP  Use UM XML APP application name\n"
 ;
@@ -102,6 +126,12 @@ const char usage[] =
 const char * OptionString = "Ac:CEfhOqr:N:s:SU:vVX:Y:";
 #define OPTION_MAX_SOURCES 0
 #define OPTION_CONTEXT_STATS 1
+#define OPTION_VERIFY_THREADS 2
+#define OPTION_VERIFY_CPUS 3
+#define OPTION_WARMUP 4
+#define OPTION_WINDOWS 5
+#define OPTION_STEADY_CV 6
+#define MAX_VERIFY_THREADS 16
 const struct option OptionTable[] = {
 	{ "ascii", no_argument, NULL, 'A' },
 	{ "config", required_argument, NULL, 'c' },
@@ -121,6 +151,11 @@ const struct option OptionTable[] = {
 	{ "xml-appname", required_argument, NULL, 'Y' },
 	{ "max-sources", required_argument, NULL, OPTION_MAX_SOURCES },
 	{ "context-stats", no_argument, NULL, OPTION_CONTEXT_STATS },
+	{ "verify-threads", required_argument, NULL, OPTION_VERIFY_THREADS },
+	{ "verify-cpus", required_argument, NULL, OPTION_VERIFY_CPUS },
+	{ "warmup", required_argument, NULL, OPTION_WARMUP },
+	{ "windows", required_argument, NULL, OPTION_WINDOWS },
+	{ "steady-cv", required_argument, NULL, OPTION_STEADY_CV },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -143,6 +178,14 @@ struct Options {
 	char xml_appname[256];	      /* Application name reference in the XML file */
 	/* LBM monitoring options */
 	int max_sources;              /* Maximum number of source statistics to display */
+	int verify_threads;           /* Number of verify worker threads (0 = verify in callback) */
+	int verify_cpus[MAX_VERIFY_THREADS]; /* CPUs to pin the verify threads to */
+	int num_verify_cpus;          /* Number of entries in verify_cpus */
+	lbm_uint64_t warmup_msgs;     /* Messages to leave out of the summary (--warmup) */
+	lbm_uint64_t warmup_ns;       /* Or time after the first message to leave out */
+	int windows;                  /* Measurement windows (0: none) */
+	int window_secs;              /* Length of each window */
+	double steady_cv;             /* Steady state CV limit, percent */
 } options;
 
 
@@ -173,6 +216,13 @@ struct timeval cur_tv;
 struct timeval data_start_tv, data_end_tv; /* to track time since first message rcv'd */
 struct timeval starttv, endtv; 	/* to track time between printing bandwidth stats */
 struct timeval stattv; /* to track time between printing LBM transport stats */
+int warming = 0;		/* Still in the --warmup; the summary has not started */
+lbm_uint64_t warmup_seen = 0;	/* Messages received during the warm-up */
+lbm_uint64_t warmup_end_ns = 0;	/* End of a timed warm-up, set by its first message */
+meas_windows_t windows;		/* Rates in each --windows window */
+struct timeval window_start_tv;	/* Start of the current window */
+int window_msgs0 = 0;		/* stotal_msg_count at the start of the window */
+unsigned long long window_bytes0 = 0;	/* total_byte_count at the start of the window */
 int timer_id = -1;
 int verbose = 0;
 lbm_uint_t expected_sqn = 0;
@@ -181,6 +231,16 @@ lbm_rcv_transport_stats_t *stats = NULL;
 int nstats;
 
 char saved_source[LBM_MSG_MAX_SOURCE_LEN] = "";
+
+/* Per-interval results of -V checks on version 2 verifiable messages */
+int verify_ok_count = 0;
+int verify_fail_count = 0;
+int total_verify_fail_count = 0;
+lbm_uint64_t verify_gap_msgs = 0;	/* application sequence numbers skipped */
+lbm_uint64_t total_verify_gap_msgs = 0;
+int verify_misordered = 0;		/* sequence numbers older than expected */
+int verify_lat_count = 0;
+double verify_lat_sum = 0.0, verify_lat_min = 0.0, verify_lat_max = 0.0;	/* usec */
 lbm_event_queue_t *evq = NULL;
 
 
@@ -225,6 +285,352 @@ void print_bw(FILE *fp, struct timeval *tv, unsigned int msgs, unsigned int byte
 	burst_loss = 0;
 }
 
+/*
+ * Print what -V found in version 2 messages since the last call: checksum
+ * failures, gaps and misordering in the sender's sequence numbers, and
+ * one-way latency (only meaningful with synchronized clocks).
+ */
+void print_verify_stats(FILE *fp)
+{
+	if (verify_ok_count == 0 && verify_fail_count == 0)
+		return;
+	fprintf(fp, "  verified %d, failed %d, %llu gap msgs, %d misordered",
+		verify_ok_count, verify_fail_count, (unsigned long long) verify_gap_msgs, verify_misordered);
+	if (verify_lat_count > 0)
+		fprintf(fp, ", latency usec min/avg/max %.1f/%.1f/%.1f",
+			verify_lat_min, verify_lat_sum / verify_lat_count, verify_lat_max);
+	fprintf(fp, "\n");
+	verify_ok_count = 0;
+	verify_fail_count = 0;
+	verify_gap_msgs = 0;
+	verify_misordered = 0;
+	verify_lat_count = 0;
+	verify_lat_sum = 0.0;
+}
+
+/*
+ * Each source on the topic numbers its messages from its own start, so the
+ * expected sequence number is kept per source, in the source notification
+ * clientd (msg->source_clientd).
+ */
+struct verify_source {
+	lbm_uint64_t expected_seq;
+	int seq_valid;			/* expected_seq is meaningful */
+};
+
+void *verify_source_create(const char *source_name, void *clientd)
+{
+	struct verify_source *vsrc = (struct verify_source *) calloc(1, sizeof(struct verify_source));
+
+	if (vsrc == NULL) {
+		fprintf(stderr, "could not allocate verify state for source %s\n", source_name);
+		exit(1);
+	}
+	return vsrc;
+}
+
+int verify_source_delete(const char *source_name, void *clientd, void *source_clientd)
+{
+	free(source_clientd);
+	return 0;
+}
+
+/* Track the sender's sequence number and timestamp from a v2 message */
+void track_verify_info(struct verify_source *vsrc, const verifiable_msg_info_t *info)
+{
+	double lat = (double)((long long)(verifiable_msg_now_ns() - info->send_ns)) / 1000.0;
+
+	if (vsrc != NULL) {
+		if (vsrc->seq_valid && info->sequence != vsrc->expected_seq) {
+			if (info->sequence > vsrc->expected_seq) {
+				verify_gap_msgs += info->sequence - vsrc->expected_seq;
+				total_verify_gap_msgs += info->sequence - vsrc->expected_seq;
+			} else {
+				verify_misordered++;
+			}
+		}
+		if (!vsrc->seq_valid || info->sequence >= vsrc->expected_seq)
+			vsrc->expected_seq = info->sequence + 1;
+		vsrc->seq_valid = 1;
+	}
+
+	if (verify_lat_count == 0 || lat < verify_lat_min)
+		verify_lat_min = lat;
+	if (verify_lat_count == 0 || lat > verify_lat_max)
+		verify_lat_max = lat;
+	verify_lat_sum += lat;
+	verify_lat_count++;
+}
+
+/*
+ * Verify offload (--verify-threads).  The receive callback retains each
+ * message and hands it to a worker through that worker's single-producer,
+ * single-consumer ring; the worker verifies it and deletes it.  There is
+ * only ever one producer (the context or event queue thread), so the rings
+ * need no locks, just ordered loads and stores of the head and tail.
+ */
+#define VERIFY_QUEUE_SIZE 4096		/* per worker; must be a power of 2 */
+#define VERIFY_SPIN_LIMIT 10000		/* empty polls before a worker starts yielding */
+
+#if defined(_WIN32)
+	/* MSVC volatile accesses are acquire loads and release stores */
+#   define LOAD_ACQUIRE(p) (*(volatile unsigned int *)(p))
+#   define STORE_RELEASE(p, v) (*(volatile unsigned int *)(p) = (v))
+#   define THREAD_YIELD() SwitchToThread()
+#else
+#   define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#   define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#   define THREAD_YIELD() sched_yield()
+#endif /* _WIN32 */
+
+struct verify_queue_entry {
+	lbm_msg_t *msg;
+	lbm_uint64_t enqueue_ns;
+};
+
+struct verify_worker {
+	unsigned int head;                /* Next entry to verify; written by the worker */
+	char pad1[64 - sizeof(unsigned int)];
+	unsigned int tail;                /* Next free entry; written by the callback */
+	char pad2[64 - sizeof(unsigned int)];
+	int idx;
+	int cpu;                          /* CPU to pin to, or -1 */
+	verifier_ctx_t *vctx;
+	/* Running totals, read (without locking) by the stats timer */
+	lbm_uint64_t verified, failed;
+	lbm_uint64_t latency_ns;          /* Enqueue to verified, summed */
+	lbm_uint64_t max_latency_ns;      /* Since the last report */
+	struct verify_queue_entry q[VERIFY_QUEUE_SIZE];
+#if defined(_WIN32)
+	HANDLE thrdh;
+#else
+	pthread_t thrdid;
+#endif /* _WIN32 */
+};
+
+struct verify_worker *verify_workers = NULL;
+int num_verify_workers = 0;
+unsigned int verify_next_worker = 0;
+unsigned int verify_workers_stop = 0;
+unsigned int verify_max_depth = 0;	/* deepest queue seen since the last report */
+lbm_uint64_t verify_inline = 0;		/* verified in the callback because all queues were full */
+lbm_uint64_t last_verify_verified = 0, last_verify_failed = 0, last_verify_latency_ns = 0;
+
+void verify_one(verifier_ctx_t *vctx, const lbm_msg_t *msg, lbm_uint64_t *failed)
+{
+	int rc = verify_msg_r(vctx, msg->data, msg->len, 0, NULL);
+
+	if (rc == 0) {
+		printf("Message sqn %x does not verify!\n", msg->sequence_number);
+		print_verify_bad_ranges(stdout, msg->data, msg->len);
+		(*failed)++;
+	} else if (rc == -1) {
+		fprintf(stderr, "Message sqn %x is not a verifiable message.\n", msg->sequence_number);
+		fprintf(stderr, "Use -V option on source and restart receiver.\n");
+		exit(1);
+	}
+}
+
+#if defined(_WIN32)
+DWORD WINAPI verify_thread_main(void *arg)
+#else
+void *verify_thread_main(void *arg)
+#endif /* _WIN32 */
+{
+	struct verify_worker *w = (struct verify_worker *) arg;
+	unsigned int idle = 0;
+
+#if defined(_WIN32)
+	/* The following line is only needed for static Windows library use */
+	lbm_win32_static_thread_attach();
+	if (w->cpu >= 0)
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << w->cpu);
+#elif defined(__linux__)
+	if (w->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(w->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			fprintf(stderr, "could not pin verify thread %d to CPU %d\n", w->idx, w->cpu);
+	}
+#endif /* _WIN32 */
+
+	for (;;) {
+		unsigned int head = w->head;
+		struct verify_queue_entry *e;
+		lbm_uint64_t latency;
+
+		if (head == LOAD_ACQUIRE(&w->tail)) {
+			/* Empty. The callback stops producing before the stop flag is set. */
+			if (LOAD_ACQUIRE(&verify_workers_stop))
+				break;
+			if (++idle > VERIFY_SPIN_LIMIT)
+				THREAD_YIELD();
+			continue;
+		}
+		idle = 0;
+		e = &w->q[head & (VERIFY_QUEUE_SIZE - 1)];
+		verify_one(w->vctx, e->msg, &w->failed);
+		latency = current_ns() - e->enqueue_ns;
+		w->verified++;
+		w->latency_ns += latency;
+		if (latency > w->max_latency_ns)
+			w->max_latency_ns = latency;
+		lbm_msg_delete(e->msg);
+		STORE_RELEASE(&w->head, head + 1);
+	}
+#if defined(_WIN32)
+	lbm_win32_static_thread_detach();
+	return 0;
+#else
+	return NULL;
+#endif /* _WIN32 */
+}
+
+void start_verify_workers(struct Options *opts)
+{
+	int i;
+
+	num_verify_workers = opts->verify_threads;
+	verify_workers = (struct verify_worker *) calloc(num_verify_workers, sizeof(struct verify_worker));
+	if (verify_workers == NULL) {
+		fprintf(stderr, "could not allocate verify workers\n");
+		exit(1);
+	}
+	for (i = 0; i < num_verify_workers; i++) {
+		struct verify_worker *w = &verify_workers[i];
+
+		w->idx = i;
+		w->cpu = (i < opts->num_verify_cpus) ? opts->verify_cpus[i] : -1;
+		if ((w->vctx = verifier_ctx_create()) == NULL) {
+			fprintf(stderr, "could not allocate verifier context\n");
+			exit(1);
+		}
+#if defined(_WIN32)
+		if ((w->thrdh = CreateThread(NULL, 0, verify_thread_main, w, 0, NULL)) == NULL) {
+			fprintf(stderr, "could not create thread\n");
+			exit(1);
+		}
+#else
+		if (pthread_create(&w->thrdid, NULL, verify_thread_main, w) != 0) {
+			fprintf(stderr, "could not spawn thread\n");
+			exit(1);
+		}
+#endif /* _WIN32 */
+	}
+	printf("Verifying on %d worker thread(s).\n", num_verify_workers);
+}
+
+/* Fold what the workers verified since the last call into the verify counts */
+void fold_verify_worker_totals(void)
+{
+	lbm_uint64_t verified = 0, failed = 0;
+	int i;
+
+	for (i = 0; i < num_verify_workers; i++) {
+		verified += verify_workers[i].verified;
+		failed += verify_workers[i].failed;
+	}
+	verify_fail_count += (int)(failed - last_verify_failed);
+	total_verify_fail_count += (int)(failed - last_verify_failed);
+	verify_ok_count += (int)((verified - last_verify_verified) - (failed - last_verify_failed));
+	last_verify_verified = verified;
+	last_verify_failed = failed;
+}
+
+/* Let the workers drain their queues, then join them */
+void stop_verify_workers(void)
+{
+	int i;
+
+	STORE_RELEASE(&verify_workers_stop, 1);
+	for (i = 0; i < num_verify_workers; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(verify_workers[i].thrdh, INFINITE);
+#else
+		pthread_join(verify_workers[i].thrdid, NULL);
+#endif /* _WIN32 */
+		verifier_ctx_delete(verify_workers[i].vctx);
+	}
+	fold_verify_worker_totals();
+	free(verify_workers);
+	verify_workers = NULL;
+	num_verify_workers = 0;
+}
+
+/*
+ * Queue msg for a worker, starting with the next one round robin and
+ * skipping any whose queue is full. If every queue is full, verify here.
+ */
+void verify_offload(lbm_msg_t *msg)
+{
+	static verifier_ctx_t *inline_vctx = NULL;
+	lbm_uint64_t failed = 0;
+	int n;
+
+	for (n = 0; n < num_verify_workers; n++) {
+		struct verify_worker *w = &verify_workers[verify_next_worker];
+		unsigned int tail = w->tail;
+		unsigned int depth = tail - LOAD_ACQUIRE(&w->head);
+
+		if (++verify_next_worker == (unsigned int) num_verify_workers)
+			verify_next_worker = 0;
+		if (depth >= VERIFY_QUEUE_SIZE)
+			continue;
+		if (depth + 1 > verify_max_depth)
+			verify_max_depth = depth + 1;
+		lbm_msg_retain(msg);
+		w->q[tail & (VERIFY_QUEUE_SIZE - 1)].msg = msg;
+		w->q[tail & (VERIFY_QUEUE_SIZE - 1)].enqueue_ns = current_ns();
+		STORE_RELEASE(&w->tail, tail + 1);
+		return;
+	}
+	if (inline_vctx == NULL && (inline_vctx = verifier_ctx_create()) == NULL) {
+		fprintf(stderr, "could not allocate verifier context\n");
+		exit(1);
+	}
+	verify_one(inline_vctx, msg, &failed);
+	verify_inline++;
+	if (failed) {
+		verify_fail_count++;
+		total_verify_fail_count++;
+	} else {
+		verify_ok_count++;
+	}
+}
+
+/*
+ * Fold the workers' totals into the per-interval verify counts and print
+ * the queue depth and enqueue-to-verified latency since the last call.
+ */
+void print_verify_worker_stats(FILE *fp)
+{
+	lbm_uint64_t latency_ns = 0, max_latency_ns = 0, before = last_verify_verified, n;
+	unsigned int depth = 0;
+	int i;
+
+	for (i = 0; i < num_verify_workers; i++) {
+		struct verify_worker *w = &verify_workers[i];
+
+		latency_ns += w->latency_ns;
+		if (w->max_latency_ns > max_latency_ns)
+			max_latency_ns = w->max_latency_ns;
+		w->max_latency_ns = 0;	/* may race with the worker; it is only a statistic */
+		depth += w->tail - LOAD_ACQUIRE(&w->head);
+	}
+	fold_verify_worker_totals();
+	n = last_verify_verified - before;
+	fprintf(fp, "  verify queue depth %u (max %u), %llu inline",
+		depth, verify_max_depth, (unsigned long long) verify_inline);
+	if (n > 0)
+		fprintf(fp, ", queue+verify usec avg/max %.1f/%.1f",
+			(double)(latency_ns - last_verify_latency_ns) / n / 1000.0, (double)max_latency_ns / 1000.0);
+	fprintf(fp, "\n");
+	last_verify_latency_ns = latency_ns;
+	verify_max_depth = 0;
+}
+
 /* Print transport statistics */
 void print_stats(FILE *fp, lbm_rcv_transport_stats_t stats, lbm_context_t *ctx, struct Options *opts)
 {
@@ -533,6 +939,87 @@ int rcv_handle_immediate_msg(lbm_context_t *ctx, lbm_msg_t *msg, void *clientd)
 	return 0;
 }
 
+/*
+ * Once we are done receiving, unblock the event queue dispatcher (forcing
+ * it to return), or stop processing new messages until the main thread's
+ * sleep ends.
+ */
+void stop_dispatch(void)
+{
+	struct Options *opts = &options;
+
+	if (opts->eventq) { /* if using an event queue, unblock it */
+		if (lbm_event_dispatch_unblock(evq) == LBM_FAILURE) {
+			fprintf(stderr, "lbm_event_dispatch_unblock: %s\n", lbm_errmsg());
+			exit(1);
+		}
+	} else { /* we have to wait for the sleep in the main thread */
+		close_recv = 1; /* so stop processing new messages until then */
+	}
+}
+
+/*
+ * Count a message against the --warmup; returns 1 while the warm-up lasts.
+ * A timed warm-up starts with its first message.
+ */
+int warmup_msg(void)
+{
+	struct Options *opts = &options;
+
+	if (!warming)
+		return 0;
+	if (opts->warmup_msgs > 0) {
+		if (warmup_seen < opts->warmup_msgs) {
+			warmup_seen++;
+			return 1;
+		}
+	} else {
+		lbm_uint64_t now = current_ns();
+
+		if (warmup_end_ns == 0)
+			warmup_end_ns = now + opts->warmup_ns;
+		if (now < warmup_end_ns) {
+			warmup_seen++;
+			return 1;
+		}
+	}
+	warming = 0;
+	printf("Warm-up done after %" PRIu64 " messages; measuring\n", warmup_seen);
+	return 0;
+}
+
+/*
+ * Called from the 1 second timer: close the current --windows window once it
+ * has run for window_secs.  After the last one, report and quit.
+ */
+void window_tick(void)
+{
+	struct Options *opts = &options;
+	struct timeval now;
+	double secs;
+
+	if (stotal_msg_count == 0 || windows.n >= opts->windows)
+		return;
+	if (window_start_tv.tv_sec == 0 && window_start_tv.tv_usec == 0)
+		window_start_tv = data_start_tv;
+	current_tv(&now);
+	secs = ((double)now.tv_sec + (double)now.tv_usec / 1000000.0)
+		- ((double)window_start_tv.tv_sec + (double)window_start_tv.tv_usec / 1000000.0);
+	if (secs < opts->window_secs)
+		return;
+	meas_window_add(&windows, (lbm_uint64_t)(stotal_msg_count - window_msgs0),
+		(lbm_uint64_t)(total_byte_count - window_bytes0), secs);
+	window_start_tv = now;
+	window_msgs0 = stotal_msg_count;
+	window_bytes0 = total_byte_count;
+	if (windows.n == opts->windows) {
+		meas_windows_print(stdout, &windows);
+		close_recv = 1;
+		check_optional_end_conditions();
+		stop_dispatch();
+	}
+}
+
 /* Received message handler (passed into lbm_rcv_create()) */
 int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 {
@@ -548,14 +1035,16 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 			printf("*** Warning - misordered seq num %d %d\n",lastseq,msg->sequence_number);
 		lastseq = msg->sequence_number;
 		
-		/* Data message received */
-		(stotal_msg_count == 0) ? current_tv (&data_start_tv) : current_tv(&data_end_tv);
+		/* Data message received; the summary starts after any --warmup */
+		if (!warmup_msg()) {
+			(stotal_msg_count == 0) ? current_tv (&data_start_tv) : current_tv(&data_end_tv);
+			stotal_msg_count++;
+			total_byte_count += msg->len;
+		}
 		msg_count++;
 		total_msg_count++;
-		stotal_msg_count++;
 		subtotal_msg_count++;
 		byte_count += msg->len;
-		total_byte_count += msg->len;
 
 		if (msg->flags & LBM_MSG_FLAG_RETRANSMIT)
 			rx_msg_count++;
@@ -601,12 +1090,25 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 			if (opts->verbose > 1)
 				dump(msg->data, msg->len);
 		}
-		if (opts->verify_msgs)
+		if (opts->verify_msgs && num_verify_workers > 0)
+		{
+			/* The header is cheap to read here; the checksum is left to a worker */
+			verifiable_msg_info_t info;
+			int version = verify_msg_header(msg->data, msg->len, &info);
+			if (version == 2 || version == 3)
+				track_verify_info((struct verify_source *) msg->source_clientd, &info);
+			verify_offload(msg);
+		}
+		else if (opts->verify_msgs)
 		{
-			int rc = verify_msg(msg->data, msg->len, opts->verbose);
+			verifiable_msg_info_t info;
+			int rc = verify_msg_info(msg->data, msg->len, opts->verbose, &info);
 			if (rc == 0)
 			{
 				printf("Message sqn %x does not verify!\n", msg->sequence_number);
+				print_verify_bad_ranges(stdout, msg->data, msg->len);
+				verify_fail_count++;
+				total_verify_fail_count++;
 			}
 			else if (rc == -1)
 			{
@@ -620,6 +1122,9 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 				{
 					printf("Message sqn %x verifies\n", msg->sequence_number);
 				}
+				verify_ok_count++;
+				if (info.version == 2 || info.version == 3)
+					track_verify_info((struct verify_source *) msg->source_clientd, &info);
 			}
 		}
 		break;
@@ -642,13 +1147,15 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 		break;
 	case LBM_MSG_REQUEST:
 		/* Request message received (no response processed here) */
-		(stotal_msg_count == 0) ? current_tv (&data_start_tv) : current_tv(&data_end_tv);
+		if (!warmup_msg()) {
+			(stotal_msg_count == 0) ? current_tv (&data_start_tv) : current_tv(&data_end_tv);
+			stotal_msg_count++;
+			total_byte_count += msg->len;
+		}
 		msg_count++;
 		total_msg_count++;
-		stotal_msg_count++;
 		subtotal_msg_count++;
 		byte_count += msg->len;
-		total_byte_count += msg->len;
 		if (opts->verbose) {
 			printf("[@%lu.%06lu]", (unsigned long)msg->tsp.tv_sec, msg->tsp.tv_usec);
 			printf("[%s][%s][%u], Request\n",
@@ -663,6 +1170,8 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 		printf("[@%lu.%06lu]", (unsigned long)msg->tsp.tv_sec, msg->tsp.tv_usec);
 		printf("[%s][%s], End of Transport Session\n", msg->topic_name, msg->source);
 		lastseq = -1;
+		if (msg->source_clientd != NULL)
+			((struct verify_source *) msg->source_clientd)->seq_valid = 0;
 		subtotal_msg_count = 0;
 		/*
 		 * Set saved_source[0] to NULL terminate the string. We are
@@ -689,16 +1198,9 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 		/*
 		 * If we've received all that we wanted or the source has
 		 * gone away or unrecoverable loss has exceeded losslev%,
-		 * unblock the event queue dispatcher (forcing it to return).
+		 * get main() out of its dispatch loop.
 		 */
-		if (opts->eventq) { /* if using an event queue, unblock it */
-			if (lbm_event_dispatch_unblock(evq) == LBM_FAILURE) {
-				fprintf(stderr, "lbm_event_dispatch_unblock: %s\n", lbm_errmsg());
-				exit(1);
-			}
-		} else { /* we have to wait for the sleep in the main thread */
-			close_recv = 1; /* so stop processing new messages until then */
-		}
+		stop_dispatch();
 	}
 	/* LBM automatically deletes the lbm_msg_t object unless we retain it. */
 	return 0;
@@ -730,7 +1232,8 @@ int rcv_handle_tmo(lbm_context_t *ctx, const void *clientd)
 	int have_stats = 0, set_nstats;
 	lbm_context_stats_t ctx_stats;
 
-	if (!opts->stats_ivl && opts->ascii)
+	/* With -A alone there is nothing to print, but --windows still needs the ticks */
+	if (!opts->stats_ivl && opts->ascii && opts->windows == 0)
 		return 0;
 	timer_id = -1;
 	current_tv(&endtv);
@@ -804,7 +1307,16 @@ int rcv_handle_tmo(lbm_context_t *ctx, const void *clientd)
 		normalize_tv(&endtv);
 
 		print_bw(stdout, &endtv, msg_count, byte_count, unrec_count, lost, rx_msg_count, otr_msg_count);
+		if (opts->verify_msgs && num_verify_workers > 0)
+			print_verify_worker_stats(stdout);
+		if (opts->verify_msgs)
+			print_verify_stats(stdout);
+	} else if (num_verify_workers > 0) {
+		/* Nothing is printed, but the -S summary still needs the failures */
+		fold_verify_worker_totals();
 	}
+	if (opts->windows > 0)
+		window_tick();
 
 	msg_count = 0;
 	rx_msg_count = 0;
@@ -880,6 +1392,7 @@ void process_cmdline(int argc, char **argv, struct Options *opts)
 	memset(opts, 0, sizeof(*opts));
  	opts->max_sources = DEFAULT_NUM_SRCS;
 	opts->channel_number = -1;
+	opts->steady_cv = MEAS_DEFAULT_CV_PCT;
 
 	while ((c = getopt_long(argc, argv, OptionString, OptionTable, NULL)) != EOF) {
 		switch (c) {
@@ -955,6 +1468,47 @@ void process_cmdline(int argc, char **argv, struct Options *opts)
 		case OPTION_CONTEXT_STATS:
 			opts->context_stats = 1;
 			break;
+		case OPTION_VERIFY_THREADS:
+			opts->verify_threads = atoi(optarg);
+			if (opts->verify_threads < 0 || opts->verify_threads > MAX_VERIFY_THREADS) {
+				fprintf(stderr, "Number of verify threads must be between 0 and %d.\n", MAX_VERIFY_THREADS);
+				errflag++;
+			}
+			break;
+		case OPTION_WARMUP:
+			if (warmup_parse(optarg, &opts->warmup_msgs, &opts->warmup_ns) != 0) {
+				fprintf(stderr, "bad --warmup '%s'\n", optarg);
+				errflag++;
+			}
+			break;
+		case OPTION_WINDOWS:
+			opts->window_secs = 1;
+			if (sscanf(optarg, "%d,%d", &opts->windows, &opts->window_secs) < 1 ||
+				opts->windows < 1 || opts->windows > MEAS_MAX_WINDOWS || opts->window_secs < 1) {
+				fprintf(stderr, "--windows must be NUM (1 to %d) or NUM,SECS\n", MEAS_MAX_WINDOWS);
+				errflag++;
+			}
+			break;
+		case OPTION_STEADY_CV:
+			opts->steady_cv = atof(optarg);
+			if (opts->steady_cv <= 0.0)
+				errflag++;
+			break;
+		case OPTION_VERIFY_CPUS:
+			{
+				char *p = optarg, *end;
+
+				opts->num_verify_cpus = 0;
+				while (*p != '\0' && opts->num_verify_cpus < MAX_VERIFY_THREADS) {
+					opts->verify_cpus[opts->num_verify_cpus++] = (int) strtol(p, &end, 10);
+					if (end == p || (*end != ',' && *end != '\0')) {
+						errflag++;
+						break;
+					}
+					p = (*end == ',') ? end + 1 : end;
+				}
+			}
+			break;
 		default:
 			errflag++;
 			break;
@@ -980,6 +1534,7 @@ int main(int argc, char **argv)
 	struct Options *opts = &options;
 	lbm_context_attr_t * ctx_attr; /* ptr to attributes for creating context */
 	lbm_topic_t *topic; /* ptr to topic info structure for creating receiver */
+	lbm_rcv_topic_attr_t *rcv_attr = NULL; /* -V: source notification for sequence tracking */
 	lbm_rcv_t *rcv; /* ptr to a LBM receiver object */
 	lbm_hf_rcv_t *hfrcv; /* ptr to Hot Failover object (for -f cmdline option) */
 	size_t optlen; /* to be set to length of retrieved data in LBM getopt calls */
@@ -1016,6 +1571,8 @@ int main(int argc, char **argv)
 
 	/* Process command line options */
 	process_cmdline(argc, argv, opts);
+	warming = (opts->warmup_msgs > 0 || opts->warmup_ns > 0);
+	meas_windows_init(&windows, opts->steady_cv);
 
 	nstats = opts->max_sources;
 	/* Allocate array for statistics */
@@ -1196,11 +1753,31 @@ int main(int argc, char **argv)
 	signal(SIGUSR2, SigUsr2Handler);
 #endif
 
+	if (opts->verify_msgs) {
+		lbm_rcv_src_notification_func_t srcnotify;
+
+		if (lbm_rcv_topic_attr_create(&rcv_attr) == LBM_FAILURE) {
+			fprintf(stderr, "lbm_rcv_topic_attr_create: %s\n", lbm_errmsg());
+			exit(1);
+		}
+		srcnotify.create_func = verify_source_create;
+		srcnotify.delete_func = verify_source_delete;
+		srcnotify.clientd = NULL;
+		if (lbm_rcv_topic_attr_setopt(rcv_attr, "source_notification_function",
+						&srcnotify, sizeof(srcnotify)) == LBM_FAILURE) {
+			fprintf(stderr, "lbm_rcv_topic_attr_setopt:source_notification_function: %s\n",
+							 lbm_errmsg());
+			exit(1);
+		}
+	}
+
 	/* Look up desired topic */
-	if (lbm_rcv_topic_lookup(&topic, ctx, opts->topic, NULL) == LBM_FAILURE) {
+	if (lbm_rcv_topic_lookup(&topic, ctx, opts->topic, rcv_attr) == LBM_FAILURE) {
 		fprintf(stderr, "lbm_rcv_topic_lookup: %s\n", lbm_errmsg());
 		exit(1);
 	}
+	if (rcv_attr != NULL)
+		lbm_rcv_topic_attr_delete(rcv_attr);
 	/* Create an event queue for the receiver if the -q cmdline option was used.
 	 * Note that using an event queue is a design decision and is made optional
 	 * in this program only for the purpose of demonstration.
@@ -1208,6 +1785,12 @@ int main(int argc, char **argv)
 	if (opts->eventq) {
 		printf("Using an LBM event queue.\n");
 	}
+	if (opts->verify_msgs) {
+		printf("Verifying messages with the %s checksum and %s CRC32C kernels.\n",
+			inet_cksum_kernel(), crc32c_kernel());
+		if (opts->verify_threads > 0)
+			start_verify_workers(opts);
+	}
 	/*
 	 * Create receiver object passing in the looked up topic info and the message
 	 * handler callback.
@@ -1280,6 +1863,24 @@ int main(int argc, char **argv)
 		}
 	}
 
+	SLEEP_SEC(5);
+
+        	
+	if (timer_id != -1) {
+		lbm_cancel_timer(ctx, timer_id, NULL);
+	}
+	
+	if (opts->failover) {
+		lbm_hf_rcv_delete(hfrcv); /* this takes care of the associated LBM receiver */
+	} else {
+		lbm_rcv_delete(rcv);
+	}
+
+	/* No more callbacks, so nothing more to queue; finish what is queued */
+	if (num_verify_workers > 0)
+		stop_verify_workers();
+
+	/* After the workers, so the summary counts what was still queued */
 	if (opts->summary) {
 		total_time = ((double)data_end_tv.tv_sec + (double)data_end_tv.tv_usec / 1000000.0)
 					- ((double)data_start_tv.tv_sec + (double)data_start_tv.tv_usec / 1000000.0);
@@ -1292,27 +1893,18 @@ int main(int argc, char **argv)
 #endif
 
 		if (total_time > 0) {
-			total_mps = (double)total_msg_count/total_time;
+			total_mps = (double)stotal_msg_count/total_time;
 			total_bps = (double)total_byte_count*8/total_time;
 			printf ("Avg. throughput   : %-5.4g Kmsgs/sec, %-5.4g Mbps\n\n",
 									total_mps/1000.0, total_bps/1000000.0);
 		}
+		if (opts->verify_msgs) {
+			printf ("Verify failures   : %d\n", total_verify_fail_count);
+			printf ("Sequence gaps     : %llu msgs\n\n", (unsigned long long) total_verify_gap_msgs);
+		}
 
 	}
 
-	SLEEP_SEC(5);
-
-        	
-	if (timer_id != -1) {
-		lbm_cancel_timer(ctx, timer_id, NULL);
-	}
-	
-	if (opts->failover) {
-		lbm_hf_rcv_delete(hfrcv); /* this takes care of the associated LBM receiver */
-	} else {
-		lbm_rcv_delete(rcv);
-	}
-
 	lbm_context_delete(ctx);
 
 	if (opts->eventq) {
@@ -24,6 +24,9 @@
 #define _POSIX_C_SOURCE 200112L 
 #include <sys/time.h>
 #endif
+#if defined(__linux__)
+#define _GNU_SOURCE	/* for pthread_setaffinity_np() */
+#endif
 #if defined(__TANDEM) && defined(HAVE_TANDEM_SPT)
 	#include <ktdmtyp.h>
 	#include <spthread.h>
@@ -36,14 +39,23 @@
 	#include <winsock2.h>
 	#include <sys/timeb.h>
 	#define strcasecmp stricmp
+	#define snprintf _snprintf
 #else
 	#include <unistd.h>
 	#include <netinet/in.h>
 	#include <arpa/inet.h>
 	#include <signal.h>
 	#include <sys/time.h>
-	#ifdef __TANDEM
+	#include <sched.h>
+	#if defined(__TANDEM)
 		#include <strings.h>
+		#if defined(HAVE_TANDEM_SPT)
+			#include <spthread.h>
+		#else
+			#include <pthread.h>
+		#endif
+	#else
+		#include <pthread.h>
 	#endif
 #endif
 #include "replgetopt.h"
@@ -57,6 +69,8 @@
 #define MIN_ALLOC_MSGLEN 25
 #define DEFAULT_MAX_MESSAGES 10000000
 #define DEFAULT_DELAY_B4CLOSE 5
+#define DEFAULT_DRAIN_QUIET_MSEC 500
+#define DRAIN_POLL_MSEC 10
 
 #if defined(_WIN32)
 #   define SLEEP_SEC(x) Sleep((x)*1000)
@@ -84,27 +98,138 @@ const char Usage[] =
 "                               Example:  '-c file1.cfg -c file2.cfg'\n"
 "                            NOTE: For XML config files, use the -X and -Y options\n"
 "  -d, --delay=NUM           delay sending for NUM seconds after source creation\n"
+"      --wait-receivers=N[,SECS]\n"
+"                            instead of -d, start sending as soon as N receivers\n"
+"                            are connected to each source, and report how long\n"
+"                            that took; exit if it takes more than SECS seconds\n"
 "  -h, --help                display this help and exit\n"
 "  -j, --late-join=NUM       enable Late Join with specified retention buffer size (in bytes)\n"
 "  -l, --length=NUM          send messages of NUM bytes\n"
-"  -L, --linger=NUM          linger for NUM seconds before closing context\n"
+"      --size-dist=SPEC      draw message sizes from a distribution instead of -l,\n"
+"                            where SPEC is one of:\n"
+"                              SIZE:WEIGHT,... (fixed sizes, weighted)\n"
+"                              uniform:MIN,MAX\n"
+"                              lognormal:MEDIAN,SIGMA[,MAX] (MAX default 65536)\n"
+"                              file:PATH (\"SIZE WEIGHT\" lines, e.g. a histogram)\n"
+"                            sizes are drawn before the run (uses --seed); the\n"
+"                            rates are also reported per power of 2 size range\n"
+"  -L, --linger=NUM          wait up to NUM seconds for the sources to drain before\n"
+"                            closing: everything sent is on the wire, and no NAKs\n"
+"                            or retransmissions for --drain-quiet msec\n"
+"      --drain-quiet=NUM     msec without NAK, retransmission or send activity\n"
+"                            that counts as drained [500]\n"
 "  -M, --messages=NUM        send NUM messages\n"
+"      --warmup=NUM|TIME     before the -M messages, send NUM messages or for TIME\n"
+"                            (e.g. '2s' or '500ms') and leave them out of the\n"
+"                            results; paced like the measured run\n"
+"      --windows=NUM         split the -M messages into NUM measurement windows,\n"
+"                            report each one's rates and whether the run reached\n"
+"                            steady state\n"
+"      --steady-cv=PCT       with --windows, the run is steady once the window\n"
+"                            rates' coefficient of variation (stddev/mean) stays\n"
+"                            at or below PCT percent [5]\n"
 "  -n, --non-block           use non-blocking I/O\n"
+"      --batch=NUM           send messages in batches of NUM, flagging the first\n"
+"                            and last of each with LBM_MSG_START_BATCH and\n"
+"                            LBM_MSG_END_BATCH; on LBT-SMX, acquire NUM buffers\n"
+"                            before each lbm_src_buffs_complete() (NUM messages\n"
+"                            must fit in the SMX transmission window)\n"
+"      --iov=NUM             send each message as NUM segments, from separate\n"
+"                            buffers, with lbm_src_sendv()\n"
+"      --nt-copy             on LBT-SMX, copy each pre-built message (--ring, or\n"
+"                            the plain message) into the shared memory buffer\n"
+"                            with non-temporal stores; without it, plain messages\n"
+"                            only have their text and sequence number written\n"
 "  -N, --channel=NUM         send on channel NUM\n"
 "  -P, --pause=NUM           pause NUM milliseconds after each send\n"
+"      --threads=NUM         send from NUM threads, each with its own context and\n"
+"                            source; -M and --msg-rate are split between them\n"
+"      --thread-topics       with --threads, thread N sends on topic.N\n"
+"      --cpus=LIST           pin the sending threads to the comma-separated CPUs\n"
+"                            in LIST\n"
+"      --wakeup-spin=NUM     when a send would block, spin up to NUM usec for the\n"
+"                            wakeup event before parking the thread [0]\n"
+"      --msg-rate=NUM        send NUM messages per second, evenly spaced (the k and\n"
+"                            m suffixes may be used, e.g. '--msg-rate=250k');\n"
+"                            reports the achieved rate and inter-send jitter\n"
+"      --traffic=MODEL       send open-loop to a schedule worked out before the\n"
+"                            run, where MODEL is one of:\n"
+"                              poisson:RATE (random gaps, mean RATE msgs/sec)\n"
+"                              onoff:RATE,PERIOD,DUTY (RATE msgs/sec for DUTY\n"
+"                                percent of every PERIOD msec, then silent)\n"
+"                              ramp:START,END,SECS (rate rises from START to END\n"
+"                                msgs/sec over SECS seconds, then holds)\n"
+"                            rates take the k and m suffixes; uses --seed\n"
+"      --loss-schedule=FILE  inject LBT-RM and LBT-RU source loss in timed phases\n"
+"                            from FILE while sending, in place of the signals;\n"
+"                            each line is SECS (after sending starts) and one of:\n"
+"                              rate PCT\n"
+"                              burst GOOD_MS BAD_MS [BAD_PCT [GOOD_PCT]]\n"
+"                                (Gilbert-Elliott: mean time in each state,\n"
+"                                loss in each state [100, 0])\n"
+"                              blackout PERIOD_MS DARK_MS\n"
+"                            every change is logged with the messages sent so far\n"
 "  -R, --rate=[UM]DATA/RETR  Set transport type to LBT-R[UM], set data rate limit to\n"
 "                            DATA bits per second, and set retransmit rate limit to\n"
 "                            RETR bits per second.  For both limits, the optional\n"
 "                            k, m, and g suffixes may be used.  For example,\n"
 "                            '-R 1m/500k' is the same as '-R 1000000/500000'\n"
 "  -s, --statistics=NUM      print statistics every NUM seconds\n"
+"      --sweep=SIZES/RATES   instead of -l and --msg-rate, send -M messages for\n"
+"                            every pair of the comma-separated SIZES (bytes) and\n"
+"                            RATES (msgs/sec, k and m suffixes; 0 is unpaced), all\n"
+"                            on the same sources; each cell has a warm-up (--warmup,\n"
+"                            default 1s) and a drain (-L), and one CSV row of rates,\n"
+"                            send call latency, NAKs, retransmissions and blocking\n"
+"      --sweep-csv=FILE      write the --sweep CSV to FILE instead of stdout\n"
+"      --transports=LIST     run the same workload (-l, --msg-rate, -M, --warmup)\n"
+"                            on each comma-separated transport in LIST in turn\n"
+"                            (tcp, lbtrm, lbtru, lbtipc, lbtsmx, or all), with a\n"
+"                            new context and source for each, and print a table\n"
+"                            of rates, send call latency, CPU per message and\n"
+"                            retransmissions\n"
+"      --no-send-hist        do not time each send call; by default, percentiles\n"
+"                            of the time spent in the send call are printed with\n"
+"                            each -s interval and at the end\n"
 "      --context-stats       include context stats with -s option\n"
 "  -V, --verifiable          construct verifiable messages\n"
+"      --verifiable-version=NUM\n"
+"                            with -V, build version NUM messages: 1 for checksum\n"
+"                            only, 2 (default) to add sequence, timestamp and CRC32C\n"
+"      --seed=NUM            seed the verifiable message generator with NUM\n"
+"                            (same seed gives the same message contents)\n"
+"      --ring=NUM            with -V, build NUM verifiable messages up front and\n"
+"                            send them in turn instead of building one per send\n"
+"      --hugepages           back the --ring messages with huge pages if available\n"
 "  -X, --xml-config=FILE     Use UM XML configuration FILE\n"
 "  -Y, --xml-appname=APP     Use UM XML APP application name\n"
 ;
 
 #define OPTION_CONTEXT_STATS 1
+#define OPTION_SEED 2
+#define OPTION_RING 3
+#define OPTION_HUGEPAGES 4
+#define OPTION_VERIFIABLE_VERSION 5
+#define OPTION_MSG_RATE 6
+#define OPTION_WAKEUP_SPIN 7
+#define OPTION_BATCH 8
+#define OPTION_IOV 9
+#define OPTION_NT_COPY 10
+#define OPTION_THREADS 11
+#define OPTION_THREAD_TOPICS 12
+#define OPTION_CPUS 13
+#define OPTION_NO_SEND_HIST 14
+#define OPTION_TRAFFIC 15
+#define OPTION_SIZE_DIST 16
+#define OPTION_WARMUP 17
+#define OPTION_WINDOWS 18
+#define OPTION_STEADY_CV 19
+#define OPTION_WAIT_RECEIVERS 20
+#define OPTION_DRAIN_QUIET 21
+#define OPTION_SWEEP 22
+#define OPTION_SWEEP_CSV 23
+#define OPTION_TRANSPORTS 24
+#define OPTION_LOSS_SCHEDULE 25
 const char * OptionString = "c:d:j:hL:l:M:nN:P:R:s:VX:Y:";
 const struct option OptionTable[] =
 {
@@ -124,23 +249,85 @@ const struct option OptionTable[] =
 	{ "xml-appname", required_argument, NULL, 'Y' },
 	{ "channel", required_argument, NULL, 'N' },
 	{ "context-stats", no_argument, NULL, OPTION_CONTEXT_STATS },
+	{ "seed", required_argument, NULL, OPTION_SEED },
+	{ "ring", required_argument, NULL, OPTION_RING },
+	{ "hugepages", no_argument, NULL, OPTION_HUGEPAGES },
+	{ "verifiable-version", required_argument, NULL, OPTION_VERIFIABLE_VERSION },
+	{ "msg-rate", required_argument, NULL, OPTION_MSG_RATE },
+	{ "wakeup-spin", required_argument, NULL, OPTION_WAKEUP_SPIN },
+	{ "batch", required_argument, NULL, OPTION_BATCH },
+	{ "iov", required_argument, NULL, OPTION_IOV },
+	{ "nt-copy", no_argument, NULL, OPTION_NT_COPY },
+	{ "threads", required_argument, NULL, OPTION_THREADS },
+	{ "thread-topics", no_argument, NULL, OPTION_THREAD_TOPICS },
+	{ "cpus", required_argument, NULL, OPTION_CPUS },
+	{ "no-send-hist", no_argument, NULL, OPTION_NO_SEND_HIST },
+	{ "traffic", required_argument, NULL, OPTION_TRAFFIC },
+	{ "size-dist", required_argument, NULL, OPTION_SIZE_DIST },
+	{ "warmup", required_argument, NULL, OPTION_WARMUP },
+	{ "windows", required_argument, NULL, OPTION_WINDOWS },
+	{ "steady-cv", required_argument, NULL, OPTION_STEADY_CV },
+	{ "wait-receivers", required_argument, NULL, OPTION_WAIT_RECEIVERS },
+	{ "drain-quiet", required_argument, NULL, OPTION_DRAIN_QUIET },
+	{ "sweep", required_argument, NULL, OPTION_SWEEP },
+	{ "sweep-csv", required_argument, NULL, OPTION_SWEEP_CSV },
+	{ "transports", required_argument, NULL, OPTION_TRANSPORTS },
+	{ "loss-schedule", required_argument, NULL, OPTION_LOSS_SCHEDULE },
 	{ NULL, 0, NULL, 0 }
 };
 
-int blocked = 0;
+#define MAX_IOV 64		/* Most segments --iov will split a message into */
+#define MAX_SEND_THREADS 64
+#define MAX_SWEEP_VALUES 32	/* Most sizes, or rates, in a --sweep */
+#define SWEEP_DEFAULT_WARMUP_NS 1000000000
+#define MAX_TRANSPORTS 5
+
+/* The transports --transports can compare, by their "transport" option value */
+const char *transport_names[MAX_TRANSPORTS] = { "tcp", "lbtrm", "lbtru", "lbtipc", "lbtsmx" };
 
 struct Options {
 	unsigned int msgs;			/* Number of messages to be sent */
-	size_t msglen;				/* Length of messages to be sent */
+	lbm_uint64_t warmup_msgs;		/* Messages to send before measuring (--warmup) */
+	lbm_uint64_t warmup_ns;			/* Or time to send for before measuring */
+	int windows;				/* Measurement windows (0: one measurement) */
+	double steady_cv;			/* Steady state CV limit, percent */
+	size_t msglen;				/* Length of messages to be sent (with --size-dist, the largest) */
+	char *size_dist_spec;			/* Message size distribution (--size-dist) */
 	unsigned long int latejoin_threshold; 	/* Maximum Late Join buffer size, in bytes */
 	int pause;				/* Pause interval between messages */
+	double msg_rate;			/* Paced send rate, msgs/sec (0: unpaced) */
+	traffic_model_t traffic;		/* Open-loop send schedule (--traffic) */
+	unsigned long wakeup_spin_usec;		/* Spin before parking on EWOULDBLOCK */
+	int batch;				/* Messages per application batch (0: no batching) */
+	int iov_count;				/* Segments per message for lbm_src_sendv() (0: one buffer) */
+	int nt_copy;				/* Flag: SMX, copy pre-built messages with streaming stores */
+	int threads;				/* Number of sending threads */
+	int thread_topics;			/* Flag: thread N sends on topic.N */
+	int cpus[MAX_SEND_THREADS];		/* CPUs to pin the sending threads to */
+	int num_cpus;				/* Number of entries in cpus */
+	int no_send_hist;			/* Flag: do not time the send calls */
 	int delay,linger;			/* Interval to linger before and after sending messages	*/
+	rcv_wait_t rcv_wait;			/* Receivers to wait for in place of delay */
+	int drain_quiet_msec;			/* Quiet time that counts as drained */
+	size_t sweep_sizes[MAX_SWEEP_VALUES];	/* --sweep message lengths */
+	int sweep_num_sizes;			/* Number of entries in sweep_sizes (0: no sweep) */
+	double sweep_rates[MAX_SWEEP_VALUES];	/* --sweep rates, msgs/sec (0: unpaced) */
+	int sweep_num_rates;			/* Number of entries in sweep_rates */
+	char *sweep_csv;			/* File for the --sweep results (NULL: stdout) */
+	const char *transports[MAX_TRANSPORTS];	/* --transports to compare, in order */
+	int num_transports;			/* Number of entries in transports (0: as configured) */
+	char *loss_schedule;			/* --loss-schedule file (NULL: loss by signal) */
 	int block;				/* Flag to control whether blocking sends are used	*/
 	lbm_uint64_t rm_rate;			/* Rate control values */
 	lbm_uint64_t rm_retrans;		/* Rate control values */
 	char rm_protocol;			/* Rate control protocol */
 	lbm_ulong_t stats_sec;			/* Interval for dumping statistics */
 	int verifiable_msgs;			/* Flag to control message verification (verifymsg.h) */
+	int verifiable_version;			/* Verifiable message format version (1 or 2) */
+	int seed_set;				/* Flag: seed the verifiable message generator */
+	unsigned long long seed;		/* Seed for the verifiable message generator */
+	unsigned int ring_slots;		/* Number of pre-built verifiable messages */
+	int hugepages;				/* Flag: back the message ring with huge pages */
 	char *topic;				/* The topic to be sent on */
 	char context_stats;			/* flag for context stats */
 	long channel_number;			/* The channel (sub-topic) number to use */
@@ -149,6 +336,57 @@ struct Options {
 };
 
 struct Options options,*opts = &options;
+
+size_dist_t size_dist;			/* Pre-sampled --size-dist sizes, shared by the senders */
+loss_sched_t loss_sched;		/* --loss-schedule phases */
+
+/* One sending thread: its own context, source and message buffers */
+struct sender {
+	/* Written on every send; on a cache line of their own */
+	lbm_uint64_t msgs_sent;
+	lbm_uint64_t bytes_sent;
+	lbm_uint64_t seq;			/* Sequence number of the next message */
+	char pad1[64 - 3 * sizeof(lbm_uint64_t)];
+	int idx;
+	int cpu;				/* CPU to pin to, or -1 */
+	unsigned int msgs;			/* This thread's share of -M */
+	int transport;				/* transport in use (used for SMX testing) */
+	volatile int connected;			/* Receivers connected to the source */
+	char topic[LBM_MSG_MAX_TOPIC_LEN];
+	lbm_context_t *ctx;
+	lbm_src_t *src;
+	lbm_src_channel_info_t *chn;
+	int stats_timer_id;			/* This source's -s timer, or -1 */
+	lbm_src_send_ex_info_t info;
+	char *message;
+	verifier_ctx_t *vctx;			/* Builds this thread's verifiable messages */
+	verifiable_ring_t ring;			/* pre-built verifiable messages (--ring) */
+	lbm_iovec_t iov[MAX_IOV];		/* message segments for --iov */
+	pacer_t pacer;				/* send slots for --msg-rate and --traffic */
+	lbm_uint64_t *schedule;			/* --traffic send times, ns after the first */
+	send_gate_t send_gate;			/* Waits out LBM_EWOULDBLOCK until the WAKEUP event */
+	lat_hist_t send_hist;			/* Time spent in each send call */
+	lat_hist_t send_hist_base;		/* send_hist as of the last stats interval */
+	size_stats_t size_stats;		/* Messages and bytes sent by size (--size-dist) */
+	lbm_uint64_t start_ns, end_ns;		/* The measured run, after any warm-up */
+	lbm_uint64_t start_cpu_ns, end_cpu_ns;	/* Process CPU time at start_ns and end_ns */
+	const char *transport_name;		/* --transports: overrides the configured transport */
+	lbm_uint64_t bytes_before;		/* Bytes sent before bytes_sent was last cleared */
+	lbm_uint64_t naks_base, rxs_base;	/* Transport NAKs and retransmissions at the clear */
+	lbm_uint64_t send_blocked_base;		/* Context send_blocked at the clear */
+	lbm_uint64_t drain_activity;		/* Transport counters at the last drain poll */
+	lbm_uint64_t drain_since;		/* When they last changed */
+	meas_windows_t *windows;		/* Rates in each --windows window */
+#if defined(_WIN32)
+	HANDLE thrdh;
+#else
+	pthread_t thrdid;
+#endif /* _WIN32 */
+	char pad2[64];				/* Keeps the next sender's counters off our lines */
+};
+
+struct sender *senders = NULL;
+
 /* For the elapsed time, calculate and print the msgs/sec and bits/sec */
 void print_bw(FILE *fp, struct timeval *tv, unsigned int msgs, unsigned long long bytes)
 {
@@ -256,10 +494,17 @@ int lbm_log_msg(int level, const char *message, void *clientd)
 }
 
 struct TimerControl {
-	int stats_timer_id;
 	lbm_ulong_t stats_msec;
 	int stop_timer;
-} timer_control = { -1, 0, 0 };
+} timer_control = { 0, 0 };
+
+/* The --loss-schedule timer, and where the senders were at the last change */
+struct LossControl {
+	volatile int stop;			/* Set to stop the timer */
+	volatile int done;			/* Set by the timer once it has stopped */
+	lbm_uint64_t msgs;			/* Messages sent at the last change */
+	lbm_uint64_t ns;			/* Time of the last change */
+} loss_control;
 
 
 /* Source event handler callback (passed into lbm_src_create()) */
@@ -271,6 +516,7 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 			const char *clientname = (const char *)ed;
 			
 			printf("Receiver connect [%s]\n",clientname);
+			((struct sender *)cd)->connected++;
 		}
 		break;
 	case LBM_SRC_EVENT_DISCONNECT:
@@ -278,10 +524,11 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 			const char *clientname = (const char *)ed;
 			
 			printf("Receiver disconnect [%s]\n",clientname);
+			((struct sender *)cd)->connected--;
 		}
 		break;
 	case LBM_SRC_EVENT_WAKEUP:
-		blocked = 0;
+		send_gate_open(&((struct sender *)cd)->send_gate);
 		break;
 	default:
 		printf("Unknown source event %d\n", event);
@@ -293,13 +540,24 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 /* Timer callback to handle periodic display of source statistics */
 int handle_stats_timer(lbm_context_t *ctx, const void *clientd)
 {
-	lbm_src_t *src = (lbm_src_t *)clientd;
+	struct sender *s = (struct sender *)clientd;
+
+	if (opts->threads > 1)
+		printf("Thread %d: ", s->idx);
+	print_stats(stdout, s->src);
+	if (!opts->no_send_hist) {
+		char label[64];
 
-	print_stats(stdout, src);
+		if (opts->threads > 1)
+			snprintf(label, sizeof(label), "Thread %d: send call latency (ns)", s->idx);
+		else
+			snprintf(label, sizeof(label), "Send call latency (ns)");
+		lat_hist_print_interval(stdout, label, &s->send_hist, &s->send_hist_base);
+	}
 	if (!timer_control.stop_timer) {
 		/* Schedule timer to call the function handle_stats_timer() to dump the current statistics */
-		if ((timer_control.stats_timer_id = 
-			lbm_schedule_timer(ctx, handle_stats_timer, src, NULL, timer_control.stats_msec)) == -1)
+		if ((s->stats_timer_id = 
+			lbm_schedule_timer(ctx, handle_stats_timer, s, NULL, timer_control.stats_msec)) == -1)
 		{
 			fprintf(stderr, "lbm_schedule_timer: %s\n", lbm_errmsg());
 			exit(1);
@@ -308,6 +566,103 @@ int handle_stats_timer(lbm_context_t *ctx, const void *clientd)
 	return 0;
 }
 
+/* Apply the --loss-schedule every tick, and log each change against the messages sent */
+int handle_loss_timer(lbm_context_t *ctx, const void *clientd)
+{
+	lbm_uint64_t now = current_ns(), msgs = 0;
+	int phase = loss_sched.phase, prev = loss_sched.pct, pct, i;
+
+	if (loss_control.stop) {
+		loss_control.done = 1;
+		return 0;
+	}
+	pct = loss_sched_pct(&loss_sched, now);
+	if (pct != prev || loss_sched.phase != phase) {
+		if (pct != prev) {
+			lbm_set_lbtrm_src_loss_rate(pct);
+			lbm_set_lbtru_src_loss_rate(pct);
+		}
+		for (i = 0; i < opts->threads; i++)
+			msgs += senders[i].msgs_sent;
+		/* The counts start over after a warm-up */
+		if (msgs < loss_control.msgs)
+			loss_control.msgs = 0;
+		printf("Loss %d%% at %.3f secs (phase %d, %s): %" PRIu64 " msgs sent, %.0f msgs/sec since the last change\n",
+			pct, (double)(now - loss_sched.start_ns) / 1000000000.0, loss_sched.phase + 1,
+			loss_model_names[loss_sched.phases[loss_sched.phase].model], msgs,
+			(now > loss_control.ns) ? (double)(msgs - loss_control.msgs) * 1000000000.0 / (double)(now - loss_control.ns) : 0.0);
+		fflush(stdout);
+		loss_control.msgs = msgs;
+		loss_control.ns = now;
+	}
+	if (lbm_schedule_timer(ctx, handle_loss_timer, NULL, NULL, LOSS_SCHED_TICK_MSEC) == -1) {
+		fprintf(stderr, "lbm_schedule_timer: %s\n", lbm_errmsg());
+		exit(1);
+	}
+	return 0;
+}
+
+/* Parse a --sweep of "SIZE,.../RATE,..."; returns 0, or -1 if it is not valid */
+int parse_sweep(const char *arg, struct Options *opts)
+{
+	const char *p = arg;
+	char *end;
+
+	opts->sweep_num_sizes = opts->sweep_num_rates = 0;
+	for (;;) {
+		if (opts->sweep_num_sizes == MAX_SWEEP_VALUES)
+			return -1;
+		opts->sweep_sizes[opts->sweep_num_sizes] = (size_t) strtoul(p, &end, 10);
+		if (end == p || opts->sweep_sizes[opts->sweep_num_sizes] == 0)
+			return -1;
+		opts->sweep_num_sizes++;
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+	if (*end != '/')
+		return -1;
+	p = end + 1;
+	for (;;) {
+		if (opts->sweep_num_rates == MAX_SWEEP_VALUES)
+			return -1;
+		opts->sweep_rates[opts->sweep_num_rates] = traffic_parse_rate(p, &end);
+		if (end == p || opts->sweep_rates[opts->sweep_num_rates] < 0.0)
+			return -1;
+		opts->sweep_num_rates++;
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+	return (*end == '\0') ? 0 : -1;
+}
+
+/* Parse a --transports list; returns 0, or -1 if a name is not known */
+int parse_transports(const char *arg, struct Options *opts)
+{
+	const char *p = arg;
+	int i, len;
+
+	opts->num_transports = 0;
+	if (strcmp(arg, "all") == 0) {
+		for (i = 0; i < MAX_TRANSPORTS; i++)
+			opts->transports[opts->num_transports++] = transport_names[i];
+		return 0;
+	}
+	for (;;) {
+		len = (int) strcspn(p, ",");
+		for (i = 0; i < MAX_TRANSPORTS; i++) {
+			if ((int) strlen(transport_names[i]) == len && strncmp(p, transport_names[i], len) == 0)
+				break;
+		}
+		if (i == MAX_TRANSPORTS || opts->num_transports == MAX_TRANSPORTS)
+			return -1;
+		opts->transports[opts->num_transports++] = transport_names[i];
+		if (p[len] == '\0')
+			return 0;
+		p += len + 1;
+	}
+}
 
 void process_cmdline(int argc, char **argv,struct Options *opts)
 {
@@ -319,9 +674,13 @@ void process_cmdline(int argc, char **argv,struct Options *opts)
 	opts->linger = DEFAULT_DELAY_B4CLOSE;
 	opts->delay = 1;
 	opts->msglen = MIN_ALLOC_MSGLEN;
+	opts->verifiable_version = 2;
 	opts->msgs = DEFAULT_MAX_MESSAGES;
 	opts->block = 1;
 	opts->channel_number = -1;
+	opts->threads = 1;
+	opts->steady_cv = MEAS_DEFAULT_CV_PCT;
+	opts->drain_quiet_msec = DEFAULT_DRAIN_QUIET_MSEC;
 	opts->rm_protocol = 'M';
 	opts->xml_config[0] = '\0';
 	opts->xml_appname[0] = '\0';
@@ -393,17 +752,208 @@ void process_cmdline(int argc, char **argv,struct Options *opts)
 			case OPTION_CONTEXT_STATS:
 				opts->context_stats = 1;
 				break;
+			case OPTION_SEED:
+				if (sscanf(optarg, "%llu", &opts->seed) != 1)
+					++errflag;
+				opts->seed_set = 1;
+				break;
+			case OPTION_RING:
+				opts->ring_slots = atoi(optarg);
+				break;
+			case OPTION_HUGEPAGES:
+				opts->hugepages = 1;
+				break;
+			case OPTION_VERIFIABLE_VERSION:
+				opts->verifiable_version = atoi(optarg);
+				if (opts->verifiable_version != 1 && opts->verifiable_version != 2)
+					++errflag;
+				break;
+			case OPTION_WAKEUP_SPIN:
+				opts->wakeup_spin_usec = strtoul(optarg, NULL, 0);
+				break;
+			case OPTION_BATCH:
+				opts->batch = atoi(optarg);
+				if (opts->batch < 1)
+					++errflag;
+				break;
+			case OPTION_IOV:
+				opts->iov_count = atoi(optarg);
+				if (opts->iov_count < 1 || opts->iov_count > MAX_IOV)
+				{
+					fprintf(stderr, "--iov must be between 1 and %d\n", MAX_IOV);
+					++errflag;
+				}
+				break;
+			case OPTION_NT_COPY:
+				opts->nt_copy = 1;
+				break;
+			case OPTION_THREADS:
+				opts->threads = atoi(optarg);
+				if (opts->threads < 1 || opts->threads > MAX_SEND_THREADS)
+				{
+					fprintf(stderr, "--threads must be between 1 and %d\n", MAX_SEND_THREADS);
+					++errflag;
+				}
+				break;
+			case OPTION_TRAFFIC:
+				if (traffic_model_parse(optarg, &opts->traffic) != 0)
+				{
+					fprintf(stderr, "bad --traffic model '%s'\n", optarg);
+					++errflag;
+				}
+				break;
+			case OPTION_SIZE_DIST:
+				opts->size_dist_spec = optarg;
+				break;
+			case OPTION_SWEEP:
+				if (parse_sweep(optarg, opts) != 0)
+				{
+					fprintf(stderr, "--sweep must be SIZE,.../RATE,... (at most %d of each)\n", MAX_SWEEP_VALUES);
+					++errflag;
+				}
+				break;
+			case OPTION_SWEEP_CSV:
+				opts->sweep_csv = optarg;
+				break;
+			case OPTION_LOSS_SCHEDULE:
+				opts->loss_schedule = optarg;
+				break;
+			case OPTION_TRANSPORTS:
+				if (parse_transports(optarg, opts) != 0)
+				{
+					fprintf(stderr, "--transports must be a list of tcp, lbtrm, lbtru, lbtipc and lbtsmx, or all\n");
+					++errflag;
+				}
+				break;
+			case OPTION_DRAIN_QUIET:
+				opts->drain_quiet_msec = atoi(optarg);
+				if (opts->drain_quiet_msec < 0)
+					++errflag;
+				break;
+			case OPTION_WAIT_RECEIVERS:
+				if (rcv_wait_parse(optarg, &opts->rcv_wait) != 0)
+				{
+					fprintf(stderr, "bad --wait-receivers '%s'\n", optarg);
+					++errflag;
+				}
+				break;
+			case OPTION_WARMUP:
+				if (warmup_parse(optarg, &opts->warmup_msgs, &opts->warmup_ns) != 0)
+				{
+					fprintf(stderr, "bad --warmup '%s'\n", optarg);
+					++errflag;
+				}
+				break;
+			case OPTION_WINDOWS:
+				opts->windows = atoi(optarg);
+				if (opts->windows < 1 || opts->windows > MEAS_MAX_WINDOWS)
+				{
+					fprintf(stderr, "--windows must be between 1 and %d\n", MEAS_MAX_WINDOWS);
+					++errflag;
+				}
+				break;
+			case OPTION_STEADY_CV:
+				opts->steady_cv = atof(optarg);
+				if (opts->steady_cv <= 0.0)
+					++errflag;
+				break;
+			case OPTION_NO_SEND_HIST:
+				opts->no_send_hist = 1;
+				break;
+			case OPTION_THREAD_TOPICS:
+				opts->thread_topics = 1;
+				break;
+			case OPTION_CPUS:
+				{
+					char *p = optarg, *end;
+
+					opts->num_cpus = 0;
+					while (*p != '\0' && opts->num_cpus < MAX_SEND_THREADS) {
+						opts->cpus[opts->num_cpus++] = (int) strtol(p, &end, 10);
+						if (end == p || (*end != ',' && *end != '\0')) {
+							errflag++;
+							break;
+						}
+						p = (*end == ',') ? end + 1 : end;
+					}
+				}
+				break;
+			case OPTION_MSG_RATE:
+				{
+					char *end;
+
+					opts->msg_rate = strtod(optarg, &end);
+					if (*end == 'k' || *end == 'K')
+						opts->msg_rate *= 1000.0;
+					else if (*end == 'm' || *end == 'M')
+						opts->msg_rate *= 1000000.0;
+					if (opts->msg_rate <= 0.0)
+						++errflag;
+				}
+				break;
 			default:
 				errflag++;
 				break;
 		}
 	}
+	if (opts->ring_slots > 0 && !opts->verifiable_msgs)
+	{
+		fprintf(stderr, "--ring requires -V\n");
+		errflag++;
+	}
+	if (opts->nt_copy && opts->verifiable_msgs && opts->ring_slots == 0)
+	{
+		fprintf(stderr, "--nt-copy with -V requires --ring\n");
+		errflag++;
+	}
+	if (opts->msg_rate > 0.0 && opts->pause > 0)
+	{
+		fprintf(stderr, "--msg-rate and -P cannot be used together\n");
+		errflag++;
+	}
+	if (opts->traffic.model != TRAFFIC_NONE && (opts->msg_rate > 0.0 || opts->pause > 0))
+	{
+		fprintf(stderr, "--traffic cannot be used with --msg-rate or -P\n");
+		errflag++;
+	}
+	if (opts->windows > 0 && opts->msgs < (unsigned int) (opts->windows * opts->threads))
+	{
+		fprintf(stderr, "-M must give each thread at least one message per window\n");
+		errflag++;
+	}
+	if (opts->size_dist_spec != NULL && opts->iov_count > 1)
+	{
+		fprintf(stderr, "--size-dist cannot be used with --iov\n");
+		errflag++;
+	}
+	if (opts->sweep_num_sizes > 0 && (opts->size_dist_spec != NULL || opts->traffic.model != TRAFFIC_NONE ||
+		opts->msg_rate > 0.0 || opts->pause > 0 || opts->ring_slots > 0 || opts->iov_count > 1 || opts->windows > 0))
+	{
+		fprintf(stderr, "--sweep cannot be used with --size-dist, --traffic, --msg-rate, -P, --ring, --iov or --windows\n");
+		errflag++;
+	}
+	if (opts->num_transports > 0 && (opts->sweep_num_sizes > 0 || opts->rm_rate != 0 || opts->nt_copy ||
+		opts->windows > 0))
+	{
+		fprintf(stderr, "--transports cannot be used with --sweep, -R, --nt-copy or --windows\n");
+		errflag++;
+	}
+	if (opts->loss_schedule != NULL && (opts->sweep_num_sizes > 0 || opts->num_transports > 0))
+	{
+		fprintf(stderr, "--loss-schedule cannot be used with --sweep or --transports\n");
+		errflag++;
+	}
 	if ((errflag != 0) || (optind == argc))
 	{
 		/* An error occurred processing the command line - print help and exit */
 		print_help_exit(argv, 1); 		
 	}
 	opts->topic = argv[optind];
+	if (strlen(opts->topic) + 4 > LBM_MSG_MAX_TOPIC_LEN)
+	{
+		fprintf(stderr, "topic name is too long\n");
+		exit(1);
+	}
 }
 
 #if !defined(_WIN32)
@@ -453,101 +1003,118 @@ SigUsr2Handler(int signo)
 }
 #endif
 
-int main(int argc, char **argv)
+/* Allocate a sender's message buffer, --ring and --iov segments */
+void sender_build_msgs(struct sender *s)
 {
-	double secs = 0.0;
-	lbm_context_t *ctx;
-	lbm_topic_t *topic;
-	lbm_src_t *src;
-	lbm_src_topic_attr_t * tattr;
-	lbm_context_attr_t * cattr;
-	struct timeval starttv, endtv;
-	int count = 0;
-	unsigned long long bytes_sent = 0;
-	char *message = NULL;
-	void *message_SMX = NULL;	// used to bypass message (avoid copy)
-	lbm_src_channel_info_t *chn = NULL;
-	lbm_src_send_ex_info_t info;
-	int err;
-
-	int transport;		// transport in use (used for SMX testing)
-	size_t transize = 4;
-	int smx_datagram_size = -1;
-	size_t smxdgssize = 4;
-	char * xml_config_env_check = NULL;
+	int i;
 
-#if defined(_WIN32)
-	{
-		WSADATA wsadata;
-		int status;
-		
-		/* Windows socket startup code */
-		if ((status = WSAStartup(MAKEWORD(2,2),&wsadata)) != 0) {
-			fprintf(stderr,"%s: WSA startup error - %d\n",argv[0],status);
+	if (opts->verifiable_msgs) {
+		if ((s->vctx = verifier_ctx_create()) == NULL) {
+			fprintf(stderr, "could not allocate verifier context\n");
 			exit(1);
 		}
-	}
-#else
-	/*
-	 * Ignore SIGPIPE on UNIXes which can occur when writing to a socket
-	 * with only one open end point.
-	 */
-	signal(SIGPIPE, SIG_IGN);
-#endif /* _WIN32 */
-
-	/* Process the different options set by the command line processing */
-	process_cmdline(argc,argv,opts);
-
-	/* If set, check the requested message length is not too small */
-	if (opts->verifiable_msgs != 0)
-	{
-		size_t min_msglen = minimum_verifiable_msglen();
-		if (opts->msglen < min_msglen)
-		{
-			printf("Specified message length %u is too small for verifiable messages.\n", (unsigned) opts->msglen);
-			printf("Setting message length to minimum (%u).\n", (unsigned) min_msglen);
-			opts->msglen = min_msglen;
-		}
-	}
-	
-	/* Setup logging callback */
-	if (lbm_log(lbm_log_msg, NULL) == LBM_FAILURE) {
-		fprintf(stderr, "lbm_log: %s\n", lbm_errmsg());
-		exit(1);
+		if (opts->seed_set)
+			verifier_ctx_seed(s->vctx, opts->seed + s->idx);
 	}
 
-	/* if message buffer is too small, then the sprintf will cause issues. So, allocate with a min size */
+	/* allocate at least a whole message template (see msg_template_init()) */
 	if (opts->msglen < MIN_ALLOC_MSGLEN) {
-		message = (char *) malloc(MIN_ALLOC_MSGLEN);
+		s->message = (char *) malloc(MIN_ALLOC_MSGLEN);
 	} else {
-		message = (char *) malloc(opts->msglen);
+		s->message = (char *) malloc(opts->msglen);
 	}
 	
-	if (message == NULL) {
+	if (s->message == NULL) {
 		fprintf(stderr, "could not allocate message buffer of size %u bytes\n",(unsigned) opts->msglen);
 		exit(1);
 	}
 	
-	memset(message, 0, opts->msglen);
+	msg_template_init(s->message, opts->msglen);
 
-	if(opts->xml_config[0] != '\0'){
-		/* Exit if env is set to pre-load an XML file */
-		if ((xml_config_env_check = getenv("LBM_XML_CONFIG_FILENAME")) != NULL) {
-			fprintf(stderr, "\n ERROR!: Please unset LBM_XML_CONFIG_FILENAME so that an XML file can be loaded \n" );
-			exit(1);
+	/* Build all of the verifiable messages now, outside the timed send loop */
+	memset(&s->ring, 0, sizeof(s->ring));
+	if (opts->ring_slots > 0) {
+		static const char *page_desc[] = { "regular pages", "transparent huge pages", "huge pages" };
+
+		const size_t *lens = &opts->msglen;
+		unsigned int nlens = 1;
+
+		if (size_dist.sizes != NULL) {
+			lens = size_dist.sizes;
+			nlens = SIZE_DIST_SAMPLES;
 		}
-		if ((xml_config_env_check = getenv("LBM_UMM_INFO")) != NULL) {
-			fprintf(stderr, "\n ERROR!: Please unset LBM_UMM_INFO so that an XML file can be loaded \n" );
+		if (verifiable_ring_create(&s->ring, opts->ring_slots, lens, nlens, opts->verifiable_version, opts->hugepages) != 0) {
+			fprintf(stderr, "could not build ring of %u verifiable messages of %u bytes\n",
+				opts->ring_slots, (unsigned) opts->msglen);
 			exit(1);
 		}
-		/* Initialize configuration parameters from an XML file. */
-		if (lbm_config_xml_file(opts->xml_config, (const char *) opts->xml_appname ) == LBM_FAILURE) {
-			fprintf(stderr, "Couldn't load lbm_config_xml_file: appname: %s xml_config: %s : Error: %s\n",
-			opts->xml_appname, opts->xml_config, lbm_errmsg());
+		if (s->idx == 0)
+			printf("Built ring of %u verifiable messages (%lu bytes, %s)%s.\n",
+				s->ring.nslots, (unsigned long) s->ring.arena_len, page_desc[s->ring.hugepages],
+				(opts->threads > 1) ? " per thread" : "");
+	}
+
+	/*
+	 * Split the message for --iov: the first segment takes the remainder, the
+	 * rest are equal.  Each segment gets its own buffer, as a header and a
+	 * payload would in an application; with --ring, the segments are instead
+	 * pointed into the ring slot for each send.
+	 */
+	/* Work out the whole --traffic schedule now, so the sender only follows it */
+	if (opts->traffic.model != TRAFFIC_NONE) {
+		s->schedule = traffic_schedule_build(&opts->traffic, 1.0 / opts->threads, s->msgs,
+			(opts->seed_set ? opts->seed : (lbm_uint64_t) time(NULL)) + s->idx);
+		if (s->schedule == NULL) {
+			fprintf(stderr, "could not allocate a --traffic schedule of %u sends\n", s->msgs);
 			exit(1);
 		}
+		if (s->idx == 0 && s->msgs > 1)
+			printf("Traffic schedule: %u sends over %.3f seconds%s\n", s->msgs,
+				(double)s->schedule[s->msgs - 1] / 1000000000.0,
+				(opts->threads > 1) ? " per thread" : "");
 	}
-	
+
+	memset(s->iov, 0, sizeof(s->iov));
+	if (opts->iov_count > 1) {
+		size_t off = 0;
+
+		for (i = 0; i < opts->iov_count; i++) {
+			s->iov[i].iov_len = opts->msglen / opts->iov_count;
+			if (i == 0)
+				s->iov[i].iov_len += opts->msglen % opts->iov_count;
+			if (opts->ring_slots == 0) {
+				s->iov[i].iov_base = (char *) malloc(s->iov[i].iov_len);
+				if (s->iov[i].iov_base == NULL) {
+					fprintf(stderr, "could not allocate message segment of size %u bytes\n",(unsigned) s->iov[i].iov_len);
+					exit(1);
+				}
+				memcpy(s->iov[i].iov_base, s->message + off, s->iov[i].iov_len);
+			}
+			off += s->iov[i].iov_len;
+		}
+	}
+}
+
+/* Create a sender's context, topic and source (and channel, and stats timer) */
+void sender_create_source(struct sender *s)
+{
+	lbm_topic_t *topic;
+	lbm_src_topic_attr_t * tattr;
+	lbm_context_attr_t * cattr;
+	size_t transize = 4;
+	int smx_datagram_size = -1;
+	size_t smxdgssize = 4;
+
+	/* A new source has been handed nothing yet (see sender_drained()) */
+	s->msgs_sent = 0;
+	s->bytes_sent = 0;
+	s->bytes_before = 0;
+	s->connected = 0;
+
+	if (opts->thread_topics && opts->threads > 1)
+		snprintf(s->topic, sizeof(s->topic), "%s.%d", opts->topic, s->idx);
+	else
+		snprintf(s->topic, sizeof(s->topic), "%s", opts->topic);
 
 	/* Retrieve current context settings */
 	if (lbm_context_attr_create(&cattr) == LBM_FAILURE) {
@@ -571,7 +1138,7 @@ int main(int argc, char **argv)
 			exit(1);
 		}
 		/* fill source topic attribute object */
-		if (lbm_src_topic_attr_create_from_xml(&tattr, ctx_name, opts->topic) == LBM_FAILURE) {
+		if (lbm_src_topic_attr_create_from_xml(&tattr, ctx_name, s->topic) == LBM_FAILURE) {
 			fprintf(stderr, "lbm_src_topic_attr_create: %s\n", lbm_errmsg());
 			exit(1);
 		}
@@ -581,8 +1148,9 @@ int main(int argc, char **argv)
 	 * and the requested rate control values in the context attribute structure
 	 */
  	if (opts->rm_rate != 0) {
- 		printf("Sending with LBT-R%c data rate limit %" PRIu64 ", retransmission rate limit %" PRIu64 "\n", 
-			opts->rm_protocol,opts->rm_rate, opts->rm_retrans);
+		if (s->idx == 0)
+ 			printf("Sending with LBT-R%c data rate limit %" PRIu64 ", retransmission rate limit %" PRIu64 "\n", 
+				opts->rm_protocol,opts->rm_rate, opts->rm_retrans);
 		/* Set transport attribute to LBT-RM */
 		switch(opts->rm_protocol) {
 		case 'M':
@@ -620,6 +1188,14 @@ int main(int argc, char **argv)
 		}
  	}
 
+	/* With --transports, the transport under test replaces the configured one */
+	if (s->transport_name != NULL) {
+		if (lbm_src_topic_attr_str_setopt(tattr, "transport", s->transport_name) != 0) {
+			fprintf(stderr, "lbm_src_topic_str_setopt:transport: %s\n", lbm_errmsg());
+			exit(1);
+		}
+	}
+
 	/* If user specified a Late Join threshold, set the value in the context attribute structure */
 	if (opts->latejoin_threshold > 0)
 	{
@@ -633,25 +1209,20 @@ int main(int argc, char **argv)
 			exit(1);
 		}
 
-		printf("Enabled Late Join with message retention threshold set to %lu bytes.\n", opts->latejoin_threshold);
+		if (s->idx == 0)
+			printf("Enabled Late Join with message retention threshold set to %lu bytes.\n", opts->latejoin_threshold);
 
 	}
 
 	/* Create LBM context (passing in context attributes) */
-	if (lbm_context_create(&ctx, cattr, NULL, NULL) == LBM_FAILURE) {
+	if (lbm_context_create(&s->ctx, cattr, NULL, NULL) == LBM_FAILURE) {
 		fprintf(stderr, "lbm_context_create: %s\n", lbm_errmsg());
 		exit(1);
 	}
 	lbm_context_attr_delete(cattr);
 
-#if !defined(_WIN32)
-	signal(SIGHUP, SigHupHandler);
-	signal(SIGUSR1, SigUsr1Handler);
-	signal(SIGUSR2, SigUsr2Handler);
-#endif
-
 	/* Allocate the desired topic */
-	if (lbm_src_topic_alloc(&topic, ctx, opts->topic, tattr) == LBM_FAILURE) {
+	if (lbm_src_topic_alloc(&topic, s->ctx, s->topic, tattr) == LBM_FAILURE) {
 		fprintf(stderr, "lbm_src_topic_alloc: %s\n", lbm_errmsg());
 		exit(1);
 	}
@@ -659,23 +1230,23 @@ int main(int argc, char **argv)
 	/*
 	 * Get the transport and datagram size -- in order to optionally optimize for the SMX transport
 	*/
-	lbm_src_topic_attr_getopt(tattr, "transport", &transport, &transize);
-	if (transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
+	lbm_src_topic_attr_getopt(tattr, "transport", &s->transport, &transize);
+	if (s->transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
 		lbm_src_topic_attr_getopt(tattr, "transport_lbtsmx_datagram_max_size", &smx_datagram_size, &smxdgssize);
 	}
 	lbm_src_topic_attr_delete(tattr);
 
 	/*
 	 * Create LBM source passing in the allocated topic and event
-	 * handler. The source object is returned here in &src.
+	 * handler. The source object is returned here in &s->src.
 	 */
-	if (lbm_src_create(&src, ctx, topic, handle_src_event, NULL, NULL) == LBM_FAILURE) {
+	if (lbm_src_create(&s->src, s->ctx, topic, handle_src_event, s, NULL) == LBM_FAILURE) {
 		fprintf(stderr, "lbm_src_create: %s\n", lbm_errmsg());
 		exit(1);
 	}
 
 	/* Perform configuration validation for SMX */
-	if (transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
+	if (s->transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
 	    const int smx_header_size = 16;
 		int max_payload_size = smx_datagram_size + smx_header_size;
 
@@ -684,96 +1255,324 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Error: Message size requested is larger than configured SMX datagram size.\n");
 	    		exit(1);
 		}
+		if (opts->iov_count > 1) {
+			/* SMX messages are built in place in the acquired buffer */
+			fprintf(stderr, "Error: --iov is not supported on the SMX transport.\n");
+			exit(1);
+		}
+	}
+
+	if (opts->nt_copy && s->transport != LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
+		fprintf(stderr, "Error: --nt-copy only applies to the SMX transport.\n");
+		exit(1);
 	}
 
 	/* If a statistics were requested, setup an LBM timer to the dump the statistics */
 	if (opts->stats_sec > 0) {
-		timer_control.stats_msec = opts->stats_sec * 1000;
-
 		/* Schedule timer to call the function handle_stats_timer() to dump the current statistics */
-		if ((timer_control.stats_timer_id = 
-			lbm_schedule_timer(ctx, handle_stats_timer, src, NULL, timer_control.stats_msec)) == -1)
+		if ((s->stats_timer_id = 
+			lbm_schedule_timer(s->ctx, handle_stats_timer, s, NULL, timer_control.stats_msec)) == -1)
 		{
 			fprintf(stderr, "lbm_schedule_timer: %s\n", lbm_errmsg());
 			exit(1);
 		}
 	}
+}
 
-
-	/* Give the system a chance to cleanly initialize.
-	 * When using LBT-RM, this allows topic resolution to occur and
-	 * existing receivers to be aware of this new source.
-	 */
-	if (opts->delay > 0) {
-		printf("Will start sending in %d second%s...\n", opts->delay, ((opts->delay > 1) ? "s" : ""));
-		SLEEP_SEC(opts->delay);
-	}
-
+/* Create the sender's channel; done after the -d delay, as before threads */
+void sender_create_channel(struct sender *s)
+{
 	if (opts->channel_number >= 0)
 	{
-		printf("Sending on channel %ld\n", opts->channel_number);
-		if(lbm_src_channel_create(&chn, src, opts->channel_number) != 0) {
+		if (s->idx == 0)
+			printf("Sending on channel %ld\n", opts->channel_number);
+		if(lbm_src_channel_create(&s->chn, s->src, opts->channel_number) != 0) {
 			fprintf(stderr, "lbm_src_channel_create: %s\n", lbm_errmsg());
 			exit(1);
 		}
 
-		memset(&info, 0, sizeof(lbm_src_send_ex_info_t));
-		info.flags = LBM_SRC_SEND_EX_FLAG_CHANNEL;
-		info.channel_info = chn;	
+		memset(&s->info, 0, sizeof(lbm_src_send_ex_info_t));
+		s->info.flags = LBM_SRC_SEND_EX_FLAG_CHANNEL;
+		s->info.channel_info = s->chn;	
 	}
+}
 
-	/* Start sending messages to whomever is listening */
-	printf("Sending %u messages of size %u bytes to topic [%s]\n",
-		   opts->msgs, (unsigned)opts->msglen, opts->topic);
-	current_tv(&starttv); /* Store the start time */
-	for (count = 0; count < opts->msgs; ) {
-		if (transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
-			/* Note that flag to lbm_src_buff_acquire is 0, specifying a blocking send */
-			if (lbm_src_buff_acquire(src, &message_SMX, opts->msglen, 0) == LBM_FAILURE) {
-				fprintf(stderr, "lbm_src_buff_acquire: %s\n", lbm_errmsg());
-				exit(1);
-			}
-
-			/* Create a dummy message to send */
-			if (opts->verifiable_msgs) {
-				construct_verifiable_msg((char *)message_SMX, opts->msglen);
-			} else {
-				sprintf((char *)message_SMX, "message %u", count);
-			}
-
-		} else {
-
-			if (opts->verifiable_msgs) {
-				construct_verifiable_msg(message, opts->msglen);
-			} else {
-				sprintf(message, "message %u", count);
-			}
-		}
-
-		/* Set the blocked flag to indicate we are blocked trying to send a message */
-		blocked = 1;
+/*
+ * Poll the source's transport stats and say whether it has drained: every
+ * byte we handed it has gone out, and there has been no NAK, retransmission
+ * or other send activity for quiet_ns.  Transport byte counts include
+ * headers, so reaching our own byte count is necessary but not sufficient;
+ * the quiet time covers the rest (batching, and NAKs still in flight).
+ */
+int sender_drained(struct sender *s, lbm_uint64_t now, lbm_uint64_t quiet_ns)
+{
+	lbm_src_transport_stats_t stats;
+	lbm_uint64_t activity;
+	lbm_ulong_t handed = (lbm_ulong_t)(s->bytes_before + s->bytes_sent);
+	int flushed;
 
-		/* Send message using allocated source */
-		if (transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
-			lbm_src_buffs_complete(src);
-			err = 0;
-		} else if (chn != NULL)
-			err = lbm_src_send_ex(src, message, opts->msglen, opts->block ? 0 : LBM_SRC_NONBLOCK, &info);
-		else
-			err = lbm_src_send(src, message, opts->msglen, opts->block ? 0 : LBM_SRC_NONBLOCK);
-		if ( err == LBM_FAILURE) {
-			if (lbm_errnum() == LBM_EWOULDBLOCK)
-			{
-				/* The rate controller indicates to applications that the application is
-				 * exceeding the data rate by returning LBM_EWOULDBLOCK.
-				 * The application must wait for the WAKEUP event in the source event
-				 * handler call back function handle_src_event(). This example program
-				 * chooses to sleep unless a global variable is unblocked by handle_src_event()
-				 */
-				if (blocked)
-				{
-					SLEEP_MSEC(10);
+	if (lbm_src_retrieve_transport_stats(s->src, &stats) == LBM_FAILURE) {
+		fprintf(stderr, "lbm_src_retrieve_transport_stats: %s\n", lbm_errmsg());
+		exit(1);
+	}
+	switch (stats.type) {
+	case LBM_TRANSPORT_STAT_TCP:
+		flushed = (stats.transport.tcp.bytes_buffered == 0);
+		activity = stats.transport.tcp.bytes_buffered;
+		break;
+	case LBM_TRANSPORT_STAT_LBTRM:
+		flushed = (long)(stats.transport.lbtrm.bytes_sent - handed) >= 0;
+		activity = (lbm_uint64_t)stats.transport.lbtrm.bytes_sent
+			+ stats.transport.lbtrm.naks_rcved + stats.transport.lbtrm.rxs_sent;
+		break;
+	case LBM_TRANSPORT_STAT_LBTRU:
+		flushed = (long)(stats.transport.lbtru.bytes_sent - handed) >= 0;
+		activity = (lbm_uint64_t)stats.transport.lbtru.bytes_sent
+			+ stats.transport.lbtru.naks_rcved + stats.transport.lbtru.rxs_sent;
+		break;
+	case LBM_TRANSPORT_STAT_LBTIPC:
+		flushed = (long)(stats.transport.lbtipc.bytes_sent - handed) >= 0;
+		activity = stats.transport.lbtipc.bytes_sent;
+		break;
+	case LBM_TRANSPORT_STAT_LBTSMX:
+		flushed = (long)(stats.transport.lbtsmx.bytes_sent - handed) >= 0;
+		activity = stats.transport.lbtsmx.bytes_sent;
+		break;
+	case LBM_TRANSPORT_STAT_LBTRDMA:
+		flushed = (long)(stats.transport.lbtrdma.bytes_sent - handed) >= 0;
+		activity = stats.transport.lbtrdma.bytes_sent;
+		break;
+	default:
+		/* Nothing to go on but the quiet time */
+		flushed = 1;
+		activity = 0;
+		break;
+	}
+	if (activity != s->drain_activity) {
+		s->drain_activity = activity;
+		s->drain_since = now;
+	}
+	return flushed && now - s->drain_since >= quiet_ns;
+}
+
+/* Read the transport's NAKs and retransmissions, and the context's send_blocked */
+void sender_read_counters(struct sender *s, lbm_uint64_t *naks, lbm_uint64_t *rxs, lbm_uint64_t *send_blocked)
+{
+	lbm_src_transport_stats_t stats;
+	lbm_context_stats_t ctx_stats;
+
+	*naks = *rxs = *send_blocked = 0;
+	if (lbm_src_retrieve_transport_stats(s->src, &stats) == LBM_FAILURE) {
+		fprintf(stderr, "lbm_src_retrieve_transport_stats: %s\n", lbm_errmsg());
+		exit(1);
+	}
+	if (stats.type == LBM_TRANSPORT_STAT_LBTRM) {
+		*naks = stats.transport.lbtrm.naks_rcved;
+		*rxs = stats.transport.lbtrm.rxs_sent;
+	} else if (stats.type == LBM_TRANSPORT_STAT_LBTRU) {
+		*naks = stats.transport.lbtru.naks_rcved;
+		*rxs = stats.transport.lbtru.rxs_sent;
+	}
+	if (lbm_context_retrieve_stats(s->ctx, &ctx_stats) == LBM_FAILURE) {
+		fprintf(stderr, "lbm_context_retrieve_stats: %s\n", lbm_errmsg());
+		exit(1);
+	}
+	*send_blocked = ctx_stats.send_blocked;
+}
+
+/* Start the sender's counts over (after a warm-up, or for each --sweep cell) */
+void sender_clear_stats(struct sender *s)
+{
+	s->bytes_before += s->bytes_sent;
+	s->msgs_sent = 0;
+	s->bytes_sent = 0;
+	lat_hist_init(&s->send_hist);
+	lat_hist_init(&s->send_hist_base);
+	memset(&s->size_stats, 0, sizeof(s->size_stats));
+	send_gate_clear_stats(&s->send_gate);
+	sender_read_counters(s, &s->naks_base, &s->rxs_base, &s->send_blocked_base);
+}
+
+/* Delete the sender's context (after its source) */
+void sender_delete_context(struct sender *s)
+{
+	lbm_context_delete(s->ctx);
+	s->ctx = NULL;
+}
+
+/* Delete the sender's channel and source */
+void sender_delete_source(struct sender *s)
+{
+	if (s->chn != NULL)
+	{
+		if(lbm_src_channel_delete(s->chn) != 0) {
+			fprintf(stderr, "lbm_src_channel_delete: %s\n", lbm_errmsg());
+			exit(1);
+		}
+		s->chn = NULL;
+	}
+
+	/* The timer may already have fired without rescheduling, so ignore a failure */
+	if (s->stats_timer_id != -1) {
+		lbm_cancel_timer(s->ctx, s->stats_timer_id, NULL);
+		s->stats_timer_id = -1;
+	}
+
+	lbm_src_delete(s->src);
+	s->src = NULL;
+}
+
+/* Delete the sender's context and free its message buffers */
+void sender_delete(struct sender *s)
+{
+	int i;
+
+	if (s->ctx != NULL)
+		sender_delete_context(s);
+
+	free(s->message);
+	if (s->ring.nslots == 0) {
+		for (i = 0; i < opts->iov_count; i++)
+			free(s->iov[i].iov_base);
+	}
+	verifiable_ring_delete(&s->ring);
+	free(s->schedule);
+	free(s->windows);
+	if (s->vctx != NULL)
+		verifier_ctx_delete(s->vctx);
+}
+
+/*
+ * Send up to n messages, numbered on from s->seq, or fewer if the monotonic
+ * time until_ns (0: no limit) comes first.  Returns the number sent.
+ */
+unsigned int sender_send_msgs(struct sender *s, unsigned int n, lbm_uint64_t until_ns)
+{
+	void *message_SMX = NULL;	// used to bypass message (avoid copy)
+	unsigned int k;
+	lbm_uint64_t t0 = 0;
+	int err, i, retry = 0;
+	int pacing = (opts->msg_rate > 0.0 || s->schedule != NULL);
+
+	for (k = 0; k < n; ) {
+		lbm_uint64_t count = s->seq + k;
+		const char *sendp = s->message;
+		size_t msglen = opts->msglen;
+		int flags = opts->block ? 0 : LBM_SRC_NONBLOCK;
+		lbm_uint64_t call_ns = 0;	// time in the send calls (see --no-send-hist)
+
+		/* A timed warm-up ends between batches, never inside one */
+		if (until_ns != 0 && !retry && (opts->batch == 0 || k % opts->batch == 0) &&
+				current_ns() >= until_ns)
+			break;
+
+		if (size_dist.sizes != NULL)
+			msglen = SIZE_DIST_NEXT(&size_dist, count);
+
+		/* With a ring, the message is already built; just take the next one */
+		if (s->ring.nslots > 0) {
+			sendp = verifiable_ring_next(&s->ring, &msglen, count);
+			if (opts->iov_count > 1) {
+				size_t off = 0;
+
+				for (i = 0; i < opts->iov_count; i++) {
+					s->iov[i].iov_base = (char *) sendp + off;
+					off += s->iov[i].iov_len;
 				}
+			}
+		}
+
+		if (s->transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
+			/* Note that flag to lbm_src_buff_acquire is 0, specifying a blocking send */
+			if (!opts->no_send_hist)
+				t0 = current_ns();
+			if (lbm_src_buff_acquire(s->src, &message_SMX, msglen, 0) == LBM_FAILURE) {
+				fprintf(stderr, "lbm_src_buff_acquire: %s\n", lbm_errmsg());
+				exit(1);
+			}
+			/* On SMX, a full transmission window stalls the acquire, so it counts as send time */
+			if (!opts->no_send_hist)
+				call_ns = current_ns() - t0;
+
+			/* Create a dummy message to send */
+			if (s->ring.nslots > 0 && opts->nt_copy) {
+				nt_memcpy(message_SMX, sendp, msglen);
+			} else if (s->ring.nslots > 0) {
+				memcpy(message_SMX, sendp, msglen);
+			} else if (opts->nt_copy) {
+				MSG_TEMPLATE_SET_SEQ(s->message, msglen, count);
+				nt_memcpy(message_SMX, s->message, msglen);
+			} else if (opts->verifiable_msgs && opts->verifiable_version == 2) {
+				construct_verifiable_msg_v2_r(s->vctx, (char *)message_SMX, msglen, count);
+			} else if (opts->verifiable_msgs) {
+				construct_verifiable_msg_r(s->vctx, (char *)message_SMX, msglen);
+			} else {
+				msg_template_fill((char *)message_SMX, msglen, count);
+			}
+
+		} else if (s->ring.nslots == 0 && opts->iov_count > 1) {
+
+			if (opts->verifiable_msgs && opts->verifiable_version == 2) {
+				construct_verifiable_msgv_v2_r(s->vctx, s->iov, opts->iov_count, count);
+			} else if (opts->verifiable_msgs) {
+				construct_verifiable_msgv_r(s->vctx, s->iov, opts->iov_count);
+			} else {
+				MSG_TEMPLATE_SET_SEQ(s->iov[0].iov_base, s->iov[0].iov_len, count);
+			}
+		} else if (s->ring.nslots == 0) {
+
+			if (opts->verifiable_msgs && opts->verifiable_version == 2) {
+				construct_verifiable_msg_v2_r(s->vctx, s->message, msglen, count);
+			} else if (opts->verifiable_msgs) {
+				construct_verifiable_msg_r(s->vctx, s->message, msglen);
+			} else {
+				MSG_TEMPLATE_SET_SEQ(s->message, msglen, count);
+			}
+		}
+
+		/* Wait for this message's send slot (once; not again on an EWOULDBLOCK retry) */
+		if (pacing && !retry)
+			pacer_wait(&s->pacer);
+
+		/* UM holds batched messages until the one flagged as the end of the batch */
+		if (opts->batch > 0) {
+			if (k % opts->batch == 0)
+				flags |= LBM_MSG_START_BATCH;
+			if ((k + 1) % opts->batch == 0 || k + 1 == n)
+				flags |= LBM_MSG_END_BATCH;
+		}
+
+		/* Arm the gate; the WAKEUP event opens it if this send would block */
+		send_gate_arm(&s->send_gate);
+
+		/* Send message using allocated source */
+		if (!opts->no_send_hist)
+			t0 = current_ns();
+		if (s->transport == LBM_SRC_TOPIC_ATTR_TRANSPORT_LBTSMX) {
+			/* With --batch, the buffers acquired so far all go out together */
+			if (opts->batch == 0 || (flags & LBM_MSG_END_BATCH))
+				lbm_src_buffs_complete(s->src);
+			err = 0;
+		} else if (opts->iov_count > 1 && s->chn != NULL)
+			err = lbm_src_sendv_ex(s->src, s->iov, opts->iov_count, flags, &s->info);
+		else if (opts->iov_count > 1)
+			err = lbm_src_sendv(s->src, s->iov, opts->iov_count, flags);
+		else if (s->chn != NULL)
+			err = lbm_src_send_ex(s->src, sendp, msglen, flags, &s->info);
+		else
+			err = lbm_src_send(s->src, sendp, msglen, flags);
+		if (!opts->no_send_hist)
+			lat_hist_record(&s->send_hist, call_ns + (current_ns() - t0));
+		if ( err == LBM_FAILURE) {
+			if (lbm_errnum() == LBM_EWOULDBLOCK)
+			{
+				/* The rate controller indicates to applications that the application is
+				 * exceeding the data rate by returning LBM_EWOULDBLOCK.
+				 * The application must wait for the WAKEUP event in the source event
+				 * handler call back function handle_src_event(), which opens the gate.
+				 */
+				send_gate_wait(&s->send_gate);
+				retry = 1;
 				continue;
 			}
 			else
@@ -783,9 +1582,12 @@ int main(int argc, char **argv)
 				exit(1);
 			}
 		}
-		blocked = 0;
-		bytes_sent += (unsigned long long) opts->msglen;
-		count++;
+		s->bytes_sent += (lbm_uint64_t) msglen;
+		if (size_dist.sizes != NULL)
+			size_stats_add(&s->size_stats, msglen);
+		s->msgs_sent++;
+		retry = 0;
+		k++;
 
 		/* The user requested to pause between each packet, do so */
 		if (opts->pause > 0) {
@@ -793,58 +1595,740 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* Calculate the time it took to send the messages and dump */
-	current_tv(&endtv);
-	endtv.tv_sec -= starttv.tv_sec;
-	endtv.tv_usec -= starttv.tv_usec;
-	normalize_tv(&endtv);
-	secs = (double)endtv.tv_sec + (double)endtv.tv_usec / 1000000.0;
-	printf("Sent %u messages of size %u bytes in %.04g seconds.\n",
-			count, (unsigned)opts->msglen, secs);
+	s->seq += k;
+	return k;
+}
+
+/* Set up the pacer for --msg-rate or --traffic; a warm-up goes at the schedule's mean rate */
+void sender_pacer_init(struct sender *s, int warmup)
+{
+	if (opts->msg_rate > 0.0) {
+		pacer_init(&s->pacer, opts->msg_rate / opts->threads);
+	} else if (s->schedule != NULL) {
+		pacer_init_schedule(&s->pacer, s->schedule, s->msgs);
+		if (warmup)
+			pacer_init(&s->pacer, 1000000000.0 / s->pacer.interval_ns);
+	}
+}
+
+/* A sender's warm-up and measured run; on its own thread for each sender, or inline for one */
+#if defined(_WIN32)
+DWORD WINAPI send_thread_main(void *arg)
+#else
+void *send_thread_main(void *arg)
+#endif /* _WIN32 */
+{
+	struct sender *s = (struct sender *) arg;
+	int w;
+
+#if defined(_WIN32)
+	/* The following line is only needed for static Windows library use */
+	if (opts->threads > 1)
+		lbm_win32_static_thread_attach();
+	if (s->cpu >= 0)
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << s->cpu);
+#elif defined(__linux__)
+	if (s->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(s->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			fprintf(stderr, "could not pin send thread %d to CPU %d\n", s->idx, s->cpu);
+	}
+#endif /* _WIN32 */
+
+	/* Warm up, paced like the measured run; none of it is counted */
+	if (opts->warmup_msgs > 0 || opts->warmup_ns > 0) {
+		unsigned int n = (unsigned int)-1;
+
+		if (opts->warmup_msgs > 0)
+			n = (unsigned int)(opts->warmup_msgs / opts->threads +
+				((lbm_uint64_t) s->idx < opts->warmup_msgs % opts->threads ? 1 : 0));
+		sender_pacer_init(s, 1);
+		sender_send_msgs(s, n, (opts->warmup_ns > 0) ? current_ns() + opts->warmup_ns : 0);
+		sender_clear_stats(s);
+	}
+
+	sender_pacer_init(s, 0);
+	s->start_ns = current_ns();
+	s->start_cpu_ns = process_cpu_ns();
+	if (s->windows == NULL) {
+		sender_send_msgs(s, s->msgs, 0);
+	} else {
+		for (w = 0; w < opts->windows; w++) {
+			unsigned int n = s->msgs / opts->windows + ((unsigned int) w < s->msgs % opts->windows ? 1 : 0);
+			lbm_uint64_t msgs = s->msgs_sent, bytes = s->bytes_sent, t = current_ns();
+
+			sender_send_msgs(s, n, 0);
+			meas_window_add(s->windows, s->msgs_sent - msgs, s->bytes_sent - bytes,
+				(double)(current_ns() - t) / 1000000000.0);
+		}
+	}
+	s->end_ns = current_ns();
+	s->end_cpu_ns = process_cpu_ns();
+
+#if defined(_WIN32)
+	if (opts->threads > 1)
+		lbm_win32_static_thread_detach();
+	return 0;
+#else
+	return NULL;
+#endif /* _WIN32 */
+}
+
+/*
+ * Wait up to -L seconds for every source to drain (see sender_drained()).
+ * Returns the msec it took, or -1 if they did not drain in time.
+ */
+double senders_drain(void)
+{
+	lbm_uint64_t drain_start = current_ns(), now = drain_start;
+	lbm_uint64_t deadline = drain_start + (lbm_uint64_t)opts->linger * 1000000000;
+	lbm_uint64_t quiet_ns = (lbm_uint64_t)opts->drain_quiet_msec * 1000000;
+	lbm_uint64_t last = drain_start;
+	int drained = 0, i;
+
+	for (i = 0; i < opts->threads; i++)
+		senders[i].drain_activity = (lbm_uint64_t)-1;
+	while (!drained && now < deadline) {
+		drained = 1;
+		for (i = 0; i < opts->threads; i++) {
+			if (!sender_drained(&senders[i], now, quiet_ns))
+				drained = 0;
+		}
+		if (!drained) {
+			SLEEP_MSEC(DRAIN_POLL_MSEC);
+			now = current_ns();
+		}
+	}
+	if (!drained) {
+		printf("Not drained after %d seconds\n", opts->linger);
+		return -1.0;
+	}
+	for (i = 0; i < opts->threads; i++) {
+		if (senders[i].drain_since > last)
+			last = senders[i].drain_since;
+	}
+	printf("Drained in %.3f msec (last activity at %.3f msec)\n",
+		(double)(now - drain_start) / 1000000.0,
+		(double)(last - drain_start) / 1000000.0);
+	return (double)(now - drain_start) / 1000000.0;
+}
+
+/* Run send_thread_main() for every sender: inline for one, on a thread each for more */
+void senders_run(void)
+{
+	int i;
+
+	if (opts->threads == 1) {
+		send_thread_main(&senders[0]);
+		return;
+	}
+	for (i = 0; i < opts->threads; i++) {
+#if defined(_WIN32)
+		if ((senders[i].thrdh = CreateThread(NULL, 0, send_thread_main, &senders[i], 0, NULL)) == NULL) {
+			fprintf(stderr, "could not create thread\n");
+			exit(1);
+		}
+#else
+		if (pthread_create(&senders[i].thrdid, NULL, send_thread_main, &senders[i]) != 0) {
+			fprintf(stderr, "could not spawn thread\n");
+			exit(1);
+		}
+#endif /* _WIN32 */
+	}
+	for (i = 0; i < opts->threads; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(senders[i].thrdh, INFINITE);
+#else
+		pthread_join(senders[i].thrdid, NULL);
+#endif /* _WIN32 */
+	}
+}
+
+/* One --sweep cell: a message size and rate, and what the senders got */
+struct sweep_cell {
+	size_t size;
+	double rate;				/* msgs/sec asked for (0: unpaced) */
+	lbm_uint64_t msgs, bytes;
+	double secs;
+	lbm_uint64_t send_p50, send_p99, send_max;	/* Send call latency, ns */
+	lbm_uint64_t naks, rxs;			/* Transport NAKs received, retransmissions sent */
+	lbm_uint64_t send_blocked;		/* Context send_blocked */
+	lbm_uint64_t gate_blocks;		/* Sends that waited out LBM_EWOULDBLOCK */
+	double drain_msec;			/* -1: did not drain; 0 with -L 0: not measured */
+};
+
+/*
+ * Send -M messages for every size and rate in --sweep, on the sources we
+ * already have.  Each cell warms up, is measured, then drained, so that the
+ * NAKs and retransmissions of one cell are not counted in the next.
+ */
+void sweep_run(void)
+{
+	int ncells = opts->sweep_num_sizes * opts->sweep_num_rates;
+	struct sweep_cell *cells, *c;
+	size_t min_msglen = 1;
+	FILE *csv = stdout;
+	int z, r, n = 0, i;
+
+	if ((cells = (struct sweep_cell *) calloc(ncells, sizeof(struct sweep_cell))) == NULL) {
+		fprintf(stderr, "could not allocate sweep results\n");
+		exit(1);
+	}
+	if (opts->verifiable_msgs != 0)
+		min_msglen = (opts->verifiable_version == 2) ?
+			minimum_verifiable_msglen_v2() : minimum_verifiable_msglen();
+	for (z = 0; z < opts->sweep_num_sizes; z++) {
+		for (r = 0; r < opts->sweep_num_rates; r++, n++) {
+			static lat_hist_t send_hist;	// all of the threads together
+			struct timeval celltv;
+			lbm_uint64_t start_ns = 0, end_ns = 0;
+
+			c = &cells[n];
+			c->size = opts->sweep_sizes[z];
+			if (c->size < min_msglen)
+				c->size = min_msglen;
+			c->rate = opts->sweep_rates[r];
+			opts->msglen = c->size;
+			opts->msg_rate = c->rate;
+			for (i = 0; i < opts->threads; i++) {
+				msg_template_init(senders[i].message, opts->msglen);
+				sender_clear_stats(&senders[i]);
+			}
+			if (c->rate > 0.0)
+				printf("Cell %d of %d: %u byte messages at %.0f msgs/sec\n", n + 1, ncells,
+					(unsigned) c->size, c->rate);
+			else
+				printf("Cell %d of %d: %u byte messages, unpaced\n", n + 1, ncells, (unsigned) c->size);
+
+			senders_run();
+
+			lat_hist_init(&send_hist);
+			for (i = 0; i < opts->threads; i++) {
+				c->msgs += senders[i].msgs_sent;
+				c->bytes += senders[i].bytes_sent;
+				c->gate_blocks += senders[i].send_gate.blocks;
+				lat_hist_merge(&send_hist, &senders[i].send_hist);
+				if (i == 0 || senders[i].start_ns < start_ns)
+					start_ns = senders[i].start_ns;
+				if (senders[i].end_ns > end_ns)
+					end_ns = senders[i].end_ns;
+			}
+			c->secs = (double)(end_ns - start_ns) / 1000000000.0;
+			celltv.tv_sec = (long)((end_ns - start_ns) / 1000000000);
+			celltv.tv_usec = (long)((end_ns - start_ns) % 1000000000 / 1000);
+			print_bw(stdout, &celltv, (unsigned int) c->msgs, c->bytes);
+			if (!opts->no_send_hist) {
+				c->send_p50 = lat_hist_percentile(&send_hist, 50.0);
+				c->send_p99 = lat_hist_percentile(&send_hist, 99.0);
+				c->send_max = send_hist.max;
+			}
+
+			/* Drain before reading the counters, so the cell's last NAKs are its own */
+			if (opts->linger > 0)
+				c->drain_msec = senders_drain();
+			for (i = 0; i < opts->threads; i++) {
+				lbm_uint64_t naks, rxs, send_blocked;
+
+				sender_read_counters(&senders[i], &naks, &rxs, &send_blocked);
+				c->naks += naks - senders[i].naks_base;
+				c->rxs += rxs - senders[i].rxs_base;
+				c->send_blocked += send_blocked - senders[i].send_blocked_base;
+			}
+		}
+	}
+
+	if (opts->sweep_csv != NULL && (csv = fopen(opts->sweep_csv, "w")) == NULL) {
+		fprintf(stderr, "could not open --sweep-csv file %s\n", opts->sweep_csv);
+		exit(1);
+	}
+	if (csv == stdout)
+		printf("Sweep results:\n");
+	fprintf(csv, "size,rate,msgs,secs,msgs_per_sec,bits_per_sec,send_p50_ns,send_p99_ns,send_max_ns,"
+		"naks,retransmissions,send_blocked,would_block_waits,drain_msec\n");
+	for (n = 0; n < ncells; n++) {
+		c = &cells[n];
+		fprintf(csv, "%u,%.0f,%" PRIu64 ",%.6f,%.1f,%.0f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+			",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f\n",
+			(unsigned) c->size, c->rate, c->msgs, c->secs,
+			(c->secs > 0.0) ? (double)c->msgs / c->secs : 0.0,
+			(c->secs > 0.0) ? (double)c->bytes * 8.0 / c->secs : 0.0,
+			c->send_p50, c->send_p99, c->send_max,
+			c->naks, c->rxs, c->send_blocked, c->gate_blocks, c->drain_msec);
+	}
+	if (csv != stdout)
+		fclose(csv);
+	else
+		fflush(stdout);
+	free(cells);
+}
+
+/*
+ * Create each sender's context and source, wait for receivers (or -d) and
+ * create the channels
+ */
+void senders_start(void)
+{
+	int i;
+
+	rcv_wait_start(&opts->rcv_wait);
+	for (i = 0; i < opts->threads; i++)
+		sender_create_source(&senders[i]);
+
+	/* Give the system a chance to cleanly initialize.
+	 * When using LBT-RM, this allows topic resolution to occur and
+	 * existing receivers to be aware of this new source.
+	 */
+	if (opts->rcv_wait.needed > 0) {
+		printf("Waiting for %d receiver%s on each source...\n", opts->rcv_wait.needed,
+			(opts->rcv_wait.needed > 1) ? "s" : "");
+		for (i = 0; i < opts->threads; i++) {
+			if (rcv_wait_for(&opts->rcv_wait, &senders[i].connected) != 0) {
+				fprintf(stderr, "Timed out after %d seconds waiting for receivers (%d of %d connected to [%s])\n",
+					opts->rcv_wait.timeout_sec, senders[i].connected, opts->rcv_wait.needed, senders[i].topic);
+				exit(1);
+			}
+		}
+		rcv_wait_print(stdout, &opts->rcv_wait, "receivers connected to each source");
+	} else if (opts->delay > 0) {
+		printf("Will start sending in %d second%s...\n", opts->delay, ((opts->delay > 1) ? "s" : ""));
+		SLEEP_SEC(opts->delay);
+	}
+
+	for (i = 0; i < opts->threads; i++)
+		sender_create_channel(&senders[i]);
+}
+
+/* Drain the sources, print their final stats and delete them */
+void senders_stop(void)
+{
+	int i;
+
+	/*
+	 * Wait for the sources to drain before deleting them.  If we just exit,
+	 * then batched messages may not have been sent yet, and receivers may
+	 * still be NAKing for the last of them.
+	 */
+	if (opts->linger > 0)
+		senders_drain();
+	for (i = 0; i < opts->threads; i++) {
+		if (opts->threads > 1)
+			printf("Thread %d: ", i);
+		print_stats(stdout, senders[i].src);
+	}
+
+	printf("Deleting source%s\n", (opts->threads > 1) ? "s" : "");
+
+	/* Deallocate the sources (the contexts go after, in main()) */
+	for (i = 0; i < opts->threads; i++)
+		sender_delete_source(&senders[i]);
+}
+
+/* One --transports run: what the senders got on one transport */
+struct transport_result {
+	const char *name;
+	lbm_uint64_t msgs, bytes;
+	double secs;
+	lbm_uint64_t send_p50, send_p90, send_p99, send_p999, send_max;	/* Send call latency, ns */
+	lbm_uint64_t cpu_ns;			/* Process CPU time over the measured run */
+	lbm_uint64_t naks, rxs;			/* Transport NAKs received, retransmissions sent */
+	double drain_msec;			/* -1: did not drain; 0 with -L 0: not measured */
+};
+
+/*
+ * Run the workload on each --transports transport in turn, each with new
+ * contexts and sources, and print one table comparing them.  The CPU time
+ * is the whole process's, so it includes the context threads' share.
+ */
+void compare_run(void)
+{
+	struct transport_result results[MAX_TRANSPORTS], *t;
+	int n, i;
+
+	for (n = 0; n < opts->num_transports; n++) {
+		static lat_hist_t send_hist;	// all of the threads together
+		struct timeval endtv;
+		lbm_uint64_t start_ns = 0, end_ns = 0, start_cpu_ns = 0, end_cpu_ns = 0;
+
+		t = &results[n];
+		memset(t, 0, sizeof(*t));
+		t->name = opts->transports[n];
+		printf("Transport %s:\n", t->name);
+		for (i = 0; i < opts->threads; i++)
+			senders[i].transport_name = t->name;
+		timer_control.stop_timer = 0;
+		senders_start();
+		for (i = 0; i < opts->threads; i++)
+			sender_clear_stats(&senders[i]);
+
+		senders_run();
+
+		lat_hist_init(&send_hist);
+		for (i = 0; i < opts->threads; i++) {
+			t->msgs += senders[i].msgs_sent;
+			t->bytes += senders[i].bytes_sent;
+			lat_hist_merge(&send_hist, &senders[i].send_hist);
+			if (i == 0 || senders[i].start_ns < start_ns) {
+				start_ns = senders[i].start_ns;
+				start_cpu_ns = senders[i].start_cpu_ns;
+			}
+			if (senders[i].end_ns > end_ns) {
+				end_ns = senders[i].end_ns;
+				end_cpu_ns = senders[i].end_cpu_ns;
+			}
+		}
+		t->secs = (double)(end_ns - start_ns) / 1000000000.0;
+		t->cpu_ns = end_cpu_ns - start_cpu_ns;
+		endtv.tv_sec = (long)((end_ns - start_ns) / 1000000000);
+		endtv.tv_usec = (long)((end_ns - start_ns) % 1000000000 / 1000);
+		print_bw(stdout, &endtv, (unsigned int) t->msgs, t->bytes);
+		if (!opts->no_send_hist) {
+			t->send_p50 = lat_hist_percentile(&send_hist, 50.0);
+			t->send_p90 = lat_hist_percentile(&send_hist, 90.0);
+			t->send_p99 = lat_hist_percentile(&send_hist, 99.0);
+			t->send_p999 = lat_hist_percentile(&send_hist, 99.9);
+			t->send_max = send_hist.max;
+		}
+
+		/* Stop the stats timer before its source goes */
+		timer_control.stop_timer = 1;
+		if (opts->linger > 0)
+			t->drain_msec = senders_drain();
+		for (i = 0; i < opts->threads; i++) {
+			lbm_uint64_t naks, rxs, send_blocked;
+
+			sender_read_counters(&senders[i], &naks, &rxs, &send_blocked);
+			t->naks += naks - senders[i].naks_base;
+			t->rxs += rxs - senders[i].rxs_base;
+			if (opts->threads > 1)
+				printf("Thread %d: ", i);
+			print_stats(stdout, senders[i].src);
+		}
+		for (i = 0; i < opts->threads; i++) {
+			sender_delete_source(&senders[i]);
+			sender_delete_context(&senders[i]);
+		}
+	}
+
+	printf("%-9s %12s %10s %9s %9s %9s %9s %9s %10s %9s %9s %9s\n",
+		"transport", "msgs/sec", "Mbits/sec", "send p50", "p90", "p99", "p99.9", "max ns",
+		"CPU ns/msg", "NAKs", "rxs", "drain ms");
+	for (n = 0; n < opts->num_transports; n++) {
+		t = &results[n];
+		printf("%-9s %12.0f %10.2f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %10.0f %9" PRIu64 " %9" PRIu64 " %9.1f\n",
+			t->name,
+			(t->secs > 0.0) ? (double)t->msgs / t->secs : 0.0,
+			(t->secs > 0.0) ? (double)t->bytes * 8.0 / t->secs / 1000000.0 : 0.0,
+			t->send_p50, t->send_p90, t->send_p99, t->send_p999, t->send_max,
+			(t->msgs > 0) ? (double)t->cpu_ns / (double)t->msgs : 0.0,
+			t->naks, t->rxs, t->drain_msec);
+	}
+	fflush(stdout);
+}
+
+/* Start the --loss-schedule clock and its timer, on the first sender's context */
+void loss_start(void)
+{
+	memset(&loss_control, 0, sizeof(loss_control));
+	loss_sched_start(&loss_sched, current_ns(),
+		opts->seed_set ? opts->seed : (lbm_uint64_t) time(NULL));
+	loss_control.ns = loss_sched.start_ns;
+	if (lbm_schedule_timer(senders[0].ctx, handle_loss_timer, NULL, NULL, LOSS_SCHED_TICK_MSEC) == -1) {
+		fprintf(stderr, "lbm_schedule_timer: %s\n", lbm_errmsg());
+		exit(1);
+	}
+}
+
+/* Stop the --loss-schedule timer and turn loss off, so that the sources can drain */
+void loss_stop(void)
+{
+	int i;
+
+	loss_control.stop = 1;
+	for (i = 0; i < 100 && !loss_control.done; i++)
+		SLEEP_MSEC(LOSS_SCHED_TICK_MSEC);
+	lbm_set_lbtrm_src_loss_rate(0);
+	lbm_set_lbtru_src_loss_rate(0);
+	if (loss_sched.pct != 0)
+		printf("Loss 0%% at %.3f secs (end of sending)\n",
+			(double)(current_ns() - loss_sched.start_ns) / 1000000000.0);
+}
+
+/* Send -M messages once and report on them */
+void single_run(const char *size_desc)
+{
+	double secs = 0.0;
+	struct timeval endtv;
+	lbm_uint64_t start_ns = 0, end_ns = 0;
+	unsigned int count = 0;
+	unsigned long long bytes_sent = 0;
+	int i;
+
+	if (opts->loss_schedule != NULL)
+		loss_start();
+	senders_run();
+	if (opts->loss_schedule != NULL)
+		loss_stop();
+
+	/* Calculate the time it took to send the messages (after any warm-up) and dump */
+	for (i = 0; i < opts->threads; i++) {
+		count += (unsigned int) senders[i].msgs_sent;
+		bytes_sent += senders[i].bytes_sent;
+		if (i == 0 || senders[i].start_ns < start_ns)
+			start_ns = senders[i].start_ns;
+		if (senders[i].end_ns > end_ns)
+			end_ns = senders[i].end_ns;
+	}
+	endtv.tv_sec = (long)((end_ns - start_ns) / 1000000000);
+	endtv.tv_usec = (long)((end_ns - start_ns) % 1000000000 / 1000);
+	secs = (double)(end_ns - start_ns) / 1000000000.0;
+	printf("Sent %u messages of %s in %.04g seconds.\n",
+			count, size_desc, secs);
 	print_bw(stdout, &endtv, count, bytes_sent);
+	if (size_dist.sizes != NULL) {
+		size_stats_t size_stats;
 
-	/* Stop rescheduling the stats timer */
-	timer_control.stop_timer = 1;
+		memset(&size_stats, 0, sizeof(size_stats));
+		for (i = 0; i < opts->threads; i++)
+			size_stats_merge(&size_stats, &senders[i].size_stats);
+		size_stats_print(stdout, &size_stats, secs);
+	}
+	if (opts->windows > 0) {
+		static meas_windows_t windows;	// all of the threads together
+
+		meas_windows_init(&windows, opts->steady_cv);
+		for (i = 0; i < opts->threads; i++)
+			meas_windows_merge(&windows, senders[i].windows);
+		meas_windows_print(stdout, &windows);
+	}
+	if (!opts->no_send_hist) {
+		static lat_hist_t send_hist;	// all of the threads together
+
+		lat_hist_init(&send_hist);
+		for (i = 0; i < opts->threads; i++)
+			lat_hist_merge(&send_hist, &senders[i].send_hist);
+		lat_hist_print(stdout, "Send call latency (ns)", &send_hist, NULL, send_hist.max);
+	}
+	for (i = 0; i < opts->threads; i++) {
+		if (opts->threads > 1)
+			printf("Thread %d sent %" PRIu64 " messages\n", i, senders[i].msgs_sent);
+		if (opts->msg_rate > 0.0 || senders[i].schedule != NULL)
+			pacer_print(stdout, &senders[i].pacer);
+		send_gate_print(stdout, &senders[i].send_gate);
+	}
+	if (opts->loss_schedule != NULL)
+		loss_sched_print(stdout, &loss_sched);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	char size_desc[80];
+	char * xml_config_env_check = NULL;
 
+#if defined(_WIN32)
+	{
+		WSADATA wsadata;
+		int status;
+		
+		/* Windows socket startup code */
+		if ((status = WSAStartup(MAKEWORD(2,2),&wsadata)) != 0) {
+			fprintf(stderr,"%s: WSA startup error - %d\n",argv[0],status);
+			exit(1);
+		}
+	}
+#else
 	/*
-	 * Sleep for a bit so that batching gets out all the queued messages,
-	 * if any.  If we just exit, then some messages may not have been sent by
-	 * TCP yet.
+	 * Ignore SIGPIPE on UNIXes which can occur when writing to a socket
+	 * with only one open end point.
 	 */
-	if(opts->stats_sec > 0 && opts->stats_sec > opts->linger) {
-		printf("Delaying to catch last stats timer... \n");
-		SLEEP_SEC((opts->stats_sec - opts->linger) + 1);
+	signal(SIGPIPE, SIG_IGN);
+#endif /* _WIN32 */
+
+	/* Process the different options set by the command line processing */
+	process_cmdline(argc,argv,opts);
+
+	/* With --size-dist, the largest size takes the place of -l for the buffers */
+	if (opts->size_dist_spec != NULL)
+	{
+		size_t min_msglen = 1;
+
+		if (opts->verifiable_msgs != 0)
+			min_msglen = (opts->verifiable_version == 2) ?
+				minimum_verifiable_msglen_v2() : minimum_verifiable_msglen();
+		if (size_dist_create(&size_dist, opts->size_dist_spec, min_msglen,
+				opts->seed_set ? opts->seed : (lbm_uint64_t) time(NULL)) != 0)
+			exit(1);
+		if (size_dist.raised > 0)
+			printf("%u of %u sampled sizes raised to the verifiable minimum (%u).\n",
+				size_dist.raised, SIZE_DIST_SAMPLES, (unsigned) min_msglen);
+		opts->msglen = size_dist.max;
+		snprintf(size_desc, sizeof(size_desc), "%u to %u bytes (mean %.1f)",
+			(unsigned) size_dist.min, (unsigned) size_dist.max, size_dist.mean);
 	}
-	else
-		print_stats(stdout, src);
-	if (opts->linger > 0) {
-		printf("Lingering for %d seconds...\n", opts->linger);
-		SLEEP_SEC(opts->linger);
+
+	/* With --sweep, the largest size takes the place of -l for the buffers */
+	if (opts->sweep_num_sizes > 0)
+	{
+		opts->msglen = 0;
+		for (i = 0; i < opts->sweep_num_sizes; i++) {
+			if (opts->sweep_sizes[i] > opts->msglen)
+				opts->msglen = opts->sweep_sizes[i];
+		}
 	}
 
-	if (opts->channel_number >= 0)
+	/* If set, check the requested message length is not too small */
+	if (opts->verifiable_msgs != 0)
 	{
-		if(lbm_src_channel_delete(chn) != 0) {
-			fprintf(stderr, "lbm_src_channel_delete: %s\n", lbm_errmsg());
+		size_t min_msglen = (opts->verifiable_version == 2) ?
+			minimum_verifiable_msglen_v2() : minimum_verifiable_msglen();
+		if (opts->msglen < min_msglen)
+		{
+			printf("Specified message length %u is too small for verifiable messages.\n", (unsigned) opts->msglen);
+			printf("Setting message length to minimum (%u).\n", (unsigned) min_msglen);
+			opts->msglen = min_msglen;
+		}
+		if (opts->seed_set)
+			verifiable_msg_seed(opts->seed);
+		printf("Verifiable message generator: %.4g MB/sec\n",
+			verifiable_msg_gen_rate(opts->msglen) / 1000000.0);
+	}
+	
+	/* With --iov, the first segment carries the whole verifiable message header */
+	if (opts->iov_count > 1)
+	{
+		size_t min_first = 1;
+
+		if (opts->verifiable_msgs != 0)
+			min_first = (opts->verifiable_version == 2) ?
+				minimum_verifiable_msglen_v2() : minimum_verifiable_msglen();
+		if (opts->msglen / opts->iov_count == 0 ||
+			opts->msglen / opts->iov_count + opts->msglen % opts->iov_count < min_first)
+		{
+			fprintf(stderr, "Message length %u is too short to send in %d segments\n",
+				(unsigned) opts->msglen, opts->iov_count);
+			exit(1);
+		}
+	}
+
+	if (opts->sweep_num_sizes > 0) {
+		snprintf(size_desc, sizeof(size_desc), "each of %d sizes at each of %d rates",
+			opts->sweep_num_sizes, opts->sweep_num_rates);
+		if (opts->warmup_msgs == 0 && opts->warmup_ns == 0)
+			opts->warmup_ns = SWEEP_DEFAULT_WARMUP_NS;
+	} else if (opts->size_dist_spec == NULL)
+		snprintf(size_desc, sizeof(size_desc), "size %u bytes", (unsigned) opts->msglen);
+
+	/* Setup logging callback */
+	if (lbm_log(lbm_log_msg, NULL) == LBM_FAILURE) {
+		fprintf(stderr, "lbm_log: %s\n", lbm_errmsg());
+		exit(1);
+	}
+
+	/* Each sender's counters start on a cache line; the padding keeps them there */
+	senders = (struct sender *) calloc(opts->threads, sizeof(struct sender));
+	if (senders == NULL) {
+		fprintf(stderr, "could not allocate senders\n");
+		exit(1);
+	}
+	for (i = 0; i < opts->threads; i++) {
+		senders[i].idx = i;
+		senders[i].cpu = (i < opts->num_cpus) ? opts->cpus[i] : -1;
+		senders[i].stats_timer_id = -1;
+		senders[i].msgs = opts->msgs / opts->threads + ((unsigned) i < opts->msgs % opts->threads ? 1 : 0);
+		sender_build_msgs(&senders[i]);
+		send_gate_init(&senders[i].send_gate, (lbm_uint64_t)opts->wakeup_spin_usec * 1000);
+		if (opts->windows > 0) {
+			if ((senders[i].windows = (meas_windows_t *) malloc(sizeof(meas_windows_t))) == NULL) {
+				fprintf(stderr, "could not allocate measurement windows\n");
+				exit(1);
+			}
+			meas_windows_init(senders[i].windows, opts->steady_cv);
+		}
+	}
+
+	if(opts->xml_config[0] != '\0'){
+		/* Exit if env is set to pre-load an XML file */
+		if ((xml_config_env_check = getenv("LBM_XML_CONFIG_FILENAME")) != NULL) {
+			fprintf(stderr, "\n ERROR!: Please unset LBM_XML_CONFIG_FILENAME so that an XML file can be loaded \n" );
 			exit(1);
 		}
+		if ((xml_config_env_check = getenv("LBM_UMM_INFO")) != NULL) {
+			fprintf(stderr, "\n ERROR!: Please unset LBM_UMM_INFO so that an XML file can be loaded \n" );
+			exit(1);
+		}
+		/* Initialize configuration parameters from an XML file. */
+		if (lbm_config_xml_file(opts->xml_config, (const char *) opts->xml_appname ) == LBM_FAILURE) {
+			fprintf(stderr, "Couldn't load lbm_config_xml_file: appname: %s xml_config: %s : Error: %s\n",
+			opts->xml_appname, opts->xml_config, lbm_errmsg());
+			exit(1);
+		}
+	}
+
+	/* A --loss-schedule sets the loss rate instead of the signals */
+	if (opts->loss_schedule != NULL) {
+		if (loss_sched_read(&loss_sched, opts->loss_schedule) != 0)
+			exit(1);
+		printf("Loss schedule: %d phase%s from %s\n", loss_sched.nphases,
+			(loss_sched.nphases > 1) ? "s" : "", opts->loss_schedule);
 	}
+#if !defined(_WIN32)
+	else {
+		signal(SIGHUP, SigHupHandler);
+		signal(SIGUSR1, SigUsr1Handler);
+		signal(SIGUSR2, SigUsr2Handler);
+	}
+#endif
 
-	printf("Deleting source\n");
+	/* Create a context and source for each sending thread */
+	timer_control.stats_msec = opts->stats_sec * 1000;
+	if (opts->num_transports == 0)
+		senders_start();
+
+	/* Start sending messages to whomever is listening */
+	if (opts->thread_topics && opts->threads > 1)
+		printf("Sending %u messages of %s to topics [%s.0] to [%s.%d]\n",
+			   opts->msgs, size_desc, opts->topic, opts->topic, opts->threads - 1);
+	else
+		printf("Sending %u messages of %s to topic [%s]\n",
+			   opts->msgs, size_desc, opts->topic);
+	if (opts->threads > 1)
+		printf("Sending from %d threads, each with its own context\n", opts->threads);
+	if (opts->msg_rate > 0.0)
+		printf("Pacing sends at %.0f msgs/sec\n", opts->msg_rate);
+	if (opts->traffic.model != TRAFFIC_NONE)
+		printf("Sending open-loop to the --traffic schedule\n");
+	if (opts->batch > 0)
+		printf("Sending in batches of %d messages\n", opts->batch);
+	if (opts->iov_count > 1)
+		printf("Sending each message in %d segments\n", opts->iov_count);
+	if (opts->warmup_msgs > 0)
+		printf("Warming up with %" PRIu64 " messages first\n", opts->warmup_msgs);
+	else if (opts->warmup_ns > 0)
+		printf("Warming up for %.3f seconds first\n", (double)opts->warmup_ns / 1000000000.0);
+	if (opts->windows > 0)
+		printf("Measuring in %d windows\n", opts->windows);
+	if (opts->num_transports > 0)
+		compare_run();
+	else if (opts->sweep_num_sizes > 0)
+		sweep_run();
+	else
+		single_run(size_desc);
 
-	/* Deallocate source and LBM context */
-	lbm_src_delete(src);
-	src = NULL;
+	/* Stop rescheduling the stats timer */
+	timer_control.stop_timer = 1;
 
-	/* Delaying few seconds for final ads to propagate if enabled */
-	SLEEP_SEC(2);
+	if (opts->num_transports == 0)
+		senders_stop();
 
-	printf("Deleting context\n");
-	lbm_context_delete(ctx);
-	ctx = NULL;
+	printf("Deleting context%s\n", (opts->threads > 1) ? "s" : "");
+	for (i = 0; i < opts->threads; i++)
+		sender_delete(&senders[i]);
 
-	/* Free the message buffer used for sending */
-	free(message);
+	free(senders);
+	size_dist_delete(&size_dist);
 	return 0;
 }
-
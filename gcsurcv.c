@@ -540,6 +540,7 @@ int rcv_handle_msg(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 			if (rc == 0)
 			{
 				printf("Message sqn %x does not verify!\n", msg->sequence_number);
+				print_verify_bad_ranges(stdout, msg->data, msg->len);
 			}
 			else if (rc == -1)
 			{
@@ -104,6 +104,10 @@ const char Usage[] =
 	"Available options:\n"
 "  -c, --config=FILE         use LBM configuration file FILE\n"
 "  -d, --delay=NUM           delay sending for NUM seconds after source creation\n"
+"      --wait-receivers=N[,SECS]\n"
+"                            instead of -d, start sending as soon as N receivers\n"
+"                            are connected, and report how long that took; exit\n"
+"                            if it takes more than SECS seconds\n"
 "  -D, --deregister			 deregister the source after sending messages\n"
 "  -h, --help                display this help and exit\n"
 "  -j, --late-join           turn on UME late join\n"
@@ -115,21 +119,41 @@ const char Usage[] =
 "  -N, --seqnum-info         display sequence number information from source events\n"
 "  -n, --non-block           use non-blocking I/O\n"
 "  -P, --pause=NUM           pause NUM milliseconds after each send\n"
+"      --wakeup-spin=NUM     when a send would block, spin up to NUM usec for the\n"
+"                            wakeup event before parking the thread [0]\n"
 "  -R, --rate=[UM]DATA/RETR  Set transport type to LBT-R[UM], set data rate limit to\n"
 "                            DATA bits per second, and set retransmit rate limit to\n"
 "                            RETR bits per second.  For both limits, the optional\n"
 "                            k, m, and g suffixes may be used.  For example,\n"
 "                            '-R 1m/500k' is the same as '-R 1000000/500000'\n"
 "  -s, --statistics=NUM      print statistics every NUM seconds\n"
+"      --no-send-hist        do not time each send call; by default, percentiles\n"
+"                            of the time spent in the send call are printed with\n"
+"                            each -s interval and at the end\n"
 "  -S, --store=IP            use specified UME store\n"
 "  -t, --storename=NAME      use specified UME store\n"
 "  -v, --verbose             print additional info in verbose form\n"
 "  -V, --verifiable          construct verifiable messages\n"
+"      --verifiable-version=NUM\n"
+"                            with -V, build version NUM messages: 1 for checksum\n"
+"                            only, 2 (default) to add sequence, timestamp and CRC32C\n"
+"      --seed=NUM            seed the verifiable message generator with NUM\n"
+"                            (same seed gives the same message contents)\n"
+"      --ring=NUM            with -V, build NUM verifiable messages up front and\n"
+"                            send them in turn instead of building one per send\n"
+"      --hugepages           back the --ring messages with huge pages if available\n"
 "  -X, --xml-config=FILE     Use UM XML configuration FILE\n"
 "  -Y, --xml-appname=APP     Use UM XML APP application name\n"
 ;
 
 const char * OptionString = "c:d:Df:hI:jL:l:M:m:NnP:R:s:S:t:vVX:Y:";
+#define OPTION_SEED 1
+#define OPTION_RING 2
+#define OPTION_HUGEPAGES 3
+#define OPTION_VERIFIABLE_VERSION 4
+#define OPTION_WAKEUP_SPIN 5
+#define OPTION_NO_SEND_HIST 6
+#define OPTION_WAIT_RECEIVERS 7
 const struct option OptionTable[] =
 {
 	{ "config", required_argument, NULL, 'c' },
@@ -153,6 +177,13 @@ const struct option OptionTable[] =
 	{ "verifiable", no_argument, NULL, 'V' },
 	{ "xml-config", required_argument, NULL, 'X' },
 	{ "xml-appname", required_argument, NULL, 'Y' },
+	{ "seed", required_argument, NULL, OPTION_SEED },
+	{ "ring", required_argument, NULL, OPTION_RING },
+	{ "hugepages", no_argument, NULL, OPTION_HUGEPAGES },
+	{ "verifiable-version", required_argument, NULL, OPTION_VERIFIABLE_VERSION },
+	{ "wakeup-spin", required_argument, NULL, OPTION_WAKEUP_SPIN },
+	{ "no-send-hist", no_argument, NULL, OPTION_NO_SEND_HIST },
+	{ "wait-receivers", required_argument, NULL, OPTION_WAIT_RECEIVERS },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -161,6 +192,7 @@ struct Options {
 
 	char conffname[256];			/* Configuration filename */
 	int delay,linger;			/* Interval to linger before and after sending messages */
+	rcv_wait_t rcv_wait;			/* Receivers to wait for in place of delay */
 	int latejoin;						/* Flag to enable UME late join functionality */
 	size_t msglen;						/* Length of messages to be sent */
 	unsigned int msgs;					/* Number of messages to be sent */
@@ -168,6 +200,8 @@ struct Options {
 	int seqnum_info;			/* Flag to enable display of sequence numbers from source events */
 	int nonblock;						/* Flag to control whether blocking sends are used */
 	int pause_ivl;						/* Pause interval between messages */
+	unsigned long wakeup_spin_usec;				/* Spin before parking on EWOULDBLOCK */
+	int no_send_hist;					/* Flag: do not time the send calls */
 	lbm_uint64_t rm_rate, rm_retrans; /* Rate control values */
 	char rm_protocol;					/* Rate control protocol */
 	lbm_ulong_t stats_sec;				/* Interval for dumping statistics, in milliseconds */
@@ -176,6 +210,11 @@ struct Options {
 
 	int verbose;						/* Flag to control program verbosity */
 	int verifiable_msgs;				/* Flag to control message verification (verifymsg.h) */
+	int verifiable_version;				/* Verifiable message format version (1 or 2) */
+	int seed_set;						/* Flag: seed the verifiable message generator */
+	unsigned long long seed;			/* Seed for the verifiable message generator */
+	unsigned int ring_slots;			/* Number of pre-built verifiable messages */
+	int hugepages;						/* Flag: back the message ring with huge pages */
 
 	char *topic;						/* The topic on which messages will be sent	 */
 	int store_behavior; 				/* UME store behavior - set in config file */
@@ -185,7 +224,10 @@ struct Options {
 	char xml_appname[256];	      /* Application name reference in the XML file */
 } options;
 
-int blocked = 0;
+send_gate_t send_gate;		/* Waits out LBM_EWOULDBLOCK until the WAKEUP event */
+volatile int rcvs_connected = 0;	/* Receivers connected to the source */
+lat_hist_t send_hist;		/* Time spent in each send call */
+lat_hist_t send_hist_base;	/* send_hist as of the last stats interval */
 
 /* For the elapsed time, calculate and print the msgs/sec and bits/sec */
 void print_bw(FILE *fp, struct timeval *tv, size_t msgs, unsigned long long bytes)
@@ -310,6 +352,7 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 			const char *clientname = (const char *)ed;
 
 			printf("Receiver connect [%s]\n",clientname);
+			rcvs_connected++;
 		}
 		break;
 	case LBM_SRC_EVENT_DISCONNECT:
@@ -317,10 +360,11 @@ int handle_src_event(lbm_src_t *src, int event, void *ed, void *cd)
 			const char *clientname = (const char *)ed;
 
 			printf("Receiver disconnect [%s]\n",clientname);
+			rcvs_connected--;
 		}
 		break;
 	case LBM_SRC_EVENT_WAKEUP:
-		blocked = 0;
+		send_gate_open(&send_gate);
 		break;
 	case LBM_SRC_EVENT_SEQUENCE_NUMBER_INFO:
 		{
@@ -551,6 +595,8 @@ int handle_stats_timer(lbm_context_t *ctx, const void *clientd)
 	lbm_src_t *src = (lbm_src_t *) clientd;
 
 	print_stats(stdout, src);
+	if (!options.no_send_hist)
+		lat_hist_print_interval(stdout, "Send call latency (ns)", &send_hist, &send_hist_base);
 
 	if (!timer_control.stop_rescheduling_timer) {
 		if ((timer_control.stats_timer_id =
@@ -747,6 +793,7 @@ void process_cmdline(int argc, char **argv,struct Options *opts)
 	opts->flightsz = DEFAULT_FLIGHT_SZ;
 	opts->linger = DEFAULT_DELAY_B4CLOSE;
 	opts->msglen = MIN_ALLOC_MSGLEN;
+	opts->verifiable_version = 2;
 	opts->msgs = DEFAULT_MAX_MESSAGES;
 	opts->msgs_per_sec = DEFAULT_MSGS_PER_SEC;
 	opts->conffname[0] = '\0';
@@ -834,6 +881,34 @@ void process_cmdline(int argc, char **argv,struct Options *opts)
 					errflag++;
 				}
 				break;
+			case OPTION_SEED:
+				if (sscanf(optarg, "%llu", &opts->seed) != 1)
+					++errflag;
+				opts->seed_set = 1;
+				break;
+			case OPTION_RING:
+				opts->ring_slots = atoi(optarg);
+				break;
+			case OPTION_HUGEPAGES:
+				opts->hugepages = 1;
+				break;
+			case OPTION_WAIT_RECEIVERS:
+				if (rcv_wait_parse(optarg, &opts->rcv_wait) != 0) {
+					fprintf(stderr, "bad --wait-receivers '%s'\n", optarg);
+					++errflag;
+				}
+				break;
+			case OPTION_NO_SEND_HIST:
+				opts->no_send_hist = 1;
+				break;
+			case OPTION_WAKEUP_SPIN:
+				opts->wakeup_spin_usec = strtoul(optarg, NULL, 0);
+				break;
+			case OPTION_VERIFIABLE_VERSION:
+				opts->verifiable_version = atoi(optarg);
+				if (opts->verifiable_version != 1 && opts->verifiable_version != 2)
+					++errflag;
+				break;
 			default:
 				errflag++;
 				break;
@@ -844,6 +919,12 @@ void process_cmdline(int argc, char **argv,struct Options *opts)
 		strncpy(opts->storeip, storebuf, sizeof(opts->storeip));
 	}
 
+	if (opts->ring_slots > 0 && !opts->verifiable_msgs)
+	{
+		fprintf(stderr, "--ring requires -V\n");
+		errflag++;
+	}
+
 	if ((errflag != 0) || (optind == argc))
 	{
 		/* An error occurred processing the command line - dump the LBM version, usage and exit */
@@ -895,7 +976,12 @@ int main(int argc, char **argv)
 	unsigned long count = 0;
 	int flag_value = 0;
 	char *message = NULL;
+	const char *sendp = NULL;
+	size_t msglen = 0;
+	verifiable_ring_t ring;	/* pre-built verifiable messages (--ring) */
 	int msgs_per_ivl = 1;	/* stores result from calc_rate_vals */
+	lbm_uint64_t t0 = 0;	/* start of the send call (see --no-send-hist) */
+	int err;
 	size_t optlen = 0;
 	lbm_ume_src_force_reclaim_func_t reclaim_func;
 	lbm_ume_ctx_rcv_ctx_notification_func_t liveness_notification;
@@ -967,15 +1053,20 @@ int main(int argc, char **argv)
 
 	/* If set, check the requested message length is not too small */
 	if (opts->verifiable_msgs != 0) {
-		size_t min_msglen = minimum_verifiable_msglen();
+		size_t min_msglen = (opts->verifiable_version == 2) ?
+			minimum_verifiable_msglen_v2() : minimum_verifiable_msglen();
 		if (opts->msglen < min_msglen) {
 			printf("Specified message length %lu is too small for verifiable messages.\n", (unsigned long)opts->msglen);
 			printf("Setting message length to minimum (%lu).\n", (unsigned long)min_msglen);
 			opts->msglen = min_msglen;
 		}
+		if (opts->seed_set)
+			verifiable_msg_seed(opts->seed);
+		printf("Verifiable message generator: %.4g MB/sec\n",
+			verifiable_msg_gen_rate(opts->msglen) / 1000000.0);
 	}
 
-	/* if message buffer is too small, then the sprintf will cause issues. So, allocate with a min size */
+	/* allocate at least a whole message template (see msg_template_init()) */
 	if (opts->msglen < MIN_ALLOC_MSGLEN) {
 		message = malloc(MIN_ALLOC_MSGLEN);
 	} else {
@@ -985,7 +1076,21 @@ int main(int argc, char **argv)
 		fprintf(stderr, "could not allocate message buffer of size %lu bytes\n",(unsigned long)opts->msglen);
 		exit(1);
 	}
-	memset(message, 0, opts->msglen);
+	msg_template_init(message, opts->msglen);
+
+	/* Build all of the verifiable messages now, outside the timed send loop */
+	memset(&ring, 0, sizeof(ring));
+	if (opts->ring_slots > 0) {
+		static const char *page_desc[] = { "regular pages", "transparent huge pages", "huge pages" };
+
+		if (verifiable_ring_create(&ring, opts->ring_slots, &opts->msglen, 1, opts->verifiable_version, opts->hugepages) != 0) {
+			fprintf(stderr, "could not build ring of %u verifiable messages of %lu bytes\n",
+				opts->ring_slots, (unsigned long)opts->msglen);
+			exit(1);
+		}
+		printf("Built ring of %u verifiable messages (%lu bytes, %s).\n",
+			ring.nslots, (unsigned long)ring.arena_len, page_desc[ring.hugepages]);
+	}
 	if (opts->msgs_per_sec > 0) {
 		calc_rate_vals(opts->msgs_per_sec, &msgs_per_ivl, &opts->pause_ivl);
 
@@ -1180,6 +1285,8 @@ int main(int argc, char **argv)
 	 * Create LBM source passing in the allocated topic and event
 	 * handler. The source object is returned here in src.
 	 */
+	send_gate_init(&send_gate, (lbm_uint64_t)opts->wakeup_spin_usec * 1000);
+	rcv_wait_start(&opts->rcv_wait);
 	if (lbm_src_create(&src, ctx, topic, handle_src_event, opts, NULL) == LBM_FAILURE) {
 		fprintf(stderr, "lbm_src_create: %s\n", lbm_errmsg());
 		exit(1);
@@ -1196,7 +1303,15 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (opts->delay > 0) {
+	if (opts->rcv_wait.needed > 0) {
+		printf("Waiting for %d receiver%s...\n", opts->rcv_wait.needed, (opts->rcv_wait.needed > 1) ? "s" : "");
+		if (rcv_wait_for(&opts->rcv_wait, &rcvs_connected) != 0) {
+			fprintf(stderr, "Timed out after %d seconds waiting for receivers (%d of %d connected)\n",
+				opts->rcv_wait.timeout_sec, rcvs_connected, opts->rcv_wait.needed);
+			exit(1);
+		}
+		rcv_wait_print(stdout, &opts->rcv_wait, "receivers connected");
+	} else if (opts->delay > 0) {
 		printf("Delaying for %d second%s\n", opts->delay, ((opts->delay > 1) ? "s" : ""));
 		SLEEP_SEC(opts->delay);
 	}
@@ -1211,27 +1326,37 @@ int main(int argc, char **argv)
 		for (i = 0; i < msgs_per_ivl; i++)
 		{
 			exinfo.flags = LBM_SRC_SEND_EX_FLAG_UME_CLIENTD;
-			if (opts->verifiable_msgs) {
-				construct_verifiable_msg(message, opts->msglen);
+			sendp = message;
+			msglen = opts->msglen;
+			if (ring.nslots > 0) {
+				/* Already built; just take the next one */
+				sendp = verifiable_ring_next(&ring, &msglen, count);
+			} else if (opts->verifiable_msgs && opts->verifiable_version == 2) {
+				construct_verifiable_msg_v2(message, msglen, count);
+			} else if (opts->verifiable_msgs) {
+				construct_verifiable_msg(message, msglen);
 			} else {
-				sprintf(message, "message %lu", count);
+				MSG_TEMPLATE_SET_SEQ(message, msglen, count);
 			}
 			exinfo.ume_msg_clientd = (void *)((long long)count + 1);
 			last_clientd_sent = (lbm_uint_t)count + 1;
 			if (opts->seqnum_info) {
 				exinfo.flags |= LBM_SRC_SEND_EX_FLAG_SEQUENCE_NUMBER_INFO;
 			}
-			blocked = 1;
+			send_gate_arm(&send_gate);
 			/* Send message using allocated source */
-			if (lbm_src_send_ex(src, message, opts->msglen,
+			if (!opts->no_send_hist)
+				t0 = current_ns();
+			err = lbm_src_send_ex(src, sendp, msglen,
 						(opts->nonblock ? LBM_SRC_NONBLOCK : 0) | xflag,
-						&exinfo) == LBM_FAILURE) {
+						&exinfo);
+			if (!opts->no_send_hist)
+				lat_hist_record(&send_hist, current_ns() - t0);
+			if (err == LBM_FAILURE) {
 				if (lbm_errnum() == LBM_EWOULDBLOCK)
 				{
-					while (blocked)
-					{
-						SLEEP_MSEC(10);
-					}
+					/* handle_src_event() opens the gate on the WAKEUP event */
+					send_gate_wait(&send_gate);
 					continue;
 				}
 				if (lbm_errnum() == LBM_EUMENOREG)
@@ -1246,7 +1371,7 @@ int main(int argc, char **argv)
 					while (lbm_errnum() == LBM_EUMENOREG && !sent_ok) {
 						printf("Send unsuccessful. Waiting...\n");
 						SLEEP_MSEC(1000);
-						if (lbm_src_send_ex(src, message, opts->msglen,
+						if (lbm_src_send_ex(src, sendp, msglen,
 							(opts->nonblock ? LBM_SRC_NONBLOCK : 0) | xflag,
 								&exinfo) != LBM_FAILURE) {
 							sent_ok = 1;
@@ -1266,8 +1391,7 @@ int main(int argc, char **argv)
 					exit(1);
 				}
 			}
-			blocked = 0;
-			bytes_sent += (unsigned long long) opts->msglen;
+			bytes_sent += (unsigned long long) msglen;
 			count++;
 			appsent++;
 		}
@@ -1282,8 +1406,11 @@ int main(int argc, char **argv)
 	printf("Sent %lu messages of size %lu bytes in %.04g seconds.\n",
 			count, (unsigned long)opts->msglen, secs);
 	print_bw(stdout, &endtv, (size_t) count, bytes_sent);
+	if (!opts->no_send_hist)
+		lat_hist_print(stdout, "Send call latency (ns)", &send_hist, NULL, send_hist.max);
 	if (force_reclaim_total > 0)
 		printf("%d force reclamations\n", force_reclaim_total);
+	send_gate_print(stdout, &send_gate);
 
 	/* Stop rescheduling the stats timer */
 	timer_control.stop_rescheduling_timer = 1;
@@ -1320,6 +1447,7 @@ int main(int argc, char **argv)
 	lbm_context_delete(ctx);
 	ctx = NULL;
 	free(message);
+	verifiable_ring_delete(&ring);
 
 	return 0;
 }
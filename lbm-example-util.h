@@ -43,10 +43,17 @@
 #define LBM_EXAMPLE_UTIL_H
 
 #include <time.h>
+#include <math.h>
 #ifdef _WIN32
 	#include <sys/timeb.h>
 #else
 	#include <sys/time.h>
+	#include <sys/resource.h>
+	#include <pthread.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define NT_MEMCPY_SSE2 1
 #endif
 
 #define USECS_IN_SECOND 1000000
@@ -115,6 +122,1339 @@ void current_tv(struct timeval *tv)
 #endif /* _WIN32 */
 }
 
+/* Monotonic clock in nanoseconds, for measuring short intervals */
+lbm_uint64_t current_ns(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER ticks;
+	static LARGE_INTEGER freq;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&ticks);
+	return (lbm_uint64_t)(ticks.QuadPart / freq.QuadPart) * 1000000000
+		+ (lbm_uint64_t)(ticks.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (lbm_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif /* _WIN32 */
+}
+
+/* CPU time used by the whole process (all threads, user and system), in nanoseconds */
+lbm_uint64_t process_cpu_ns(void)
+{
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+		return 0;
+	/* FILETIMEs count 100 ns ticks */
+	return ((((lbm_uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+		(((lbm_uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return ((lbm_uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+		((lbm_uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+#endif /* _WIN32 */
+}
+
+/*
+ * Plain (non-verifiable) payload: the text "message " followed by the
+ * sequence number in binary (host byte order) at MSG_TEMPLATE_SEQ_OFFSET,
+ * then zeros.  The buffer is laid out once; the send loop only stores the
+ * counter, so the measured rate is not limited by formatting.  A message
+ * too short for the whole template gets as much of it as fits.
+ */
+#define MSG_TEMPLATE_TEXT "message "
+#define MSG_TEMPLATE_SEQ_OFFSET 8
+
+/* Write the template (text and sequence number, not the zero fill) */
+void msg_template_fill(char *buf, size_t len, lbm_uint64_t seq)
+{
+	size_t n = (len < MSG_TEMPLATE_SEQ_OFFSET) ? len : MSG_TEMPLATE_SEQ_OFFSET;
+
+	memcpy(buf, MSG_TEMPLATE_TEXT, n);
+	if (len > MSG_TEMPLATE_SEQ_OFFSET) {
+		n = len - MSG_TEMPLATE_SEQ_OFFSET;
+		memcpy(buf + MSG_TEMPLATE_SEQ_OFFSET, &seq, (n < sizeof(seq)) ? n : sizeof(seq));
+	}
+}
+
+/* Lay out a whole message buffer from the template */
+void msg_template_init(char *buf, size_t len)
+{
+	memset(buf, 0, len);
+	msg_template_fill(buf, len, 0);
+}
+
+/* Store a new sequence number in a message laid out by msg_template_init() */
+#define MSG_TEMPLATE_SET_SEQ(buf, len, seq) \
+	do { \
+		lbm_uint64_t msg_template_seq_ = (seq); \
+		if ((len) >= MSG_TEMPLATE_SEQ_OFFSET + sizeof(msg_template_seq_)) \
+			memcpy((buf) + MSG_TEMPLATE_SEQ_OFFSET, &msg_template_seq_, sizeof(msg_template_seq_)); \
+		else \
+			msg_template_fill((buf), (len), msg_template_seq_); \
+	} while (0)
+
+/*
+ * Copy with non-temporal (streaming) stores, for filling a shared memory
+ * send buffer from a pre-built message.  The destination lines go straight
+ * out to memory for the reader instead of displacing the sender's cache.
+ * The closing fence orders the stores before whatever publishes the buffer.
+ * Plain memcpy() where SSE2 is not available.
+ */
+void nt_memcpy(void *dst, const void *src, size_t len)
+{
+#if defined(NT_MEMCPY_SSE2)
+	char *d = (char *)dst;
+	const char *s = (const char *)src;
+	size_t head = (16 - ((size_t)d & 15)) & 15;
+
+	if (len < 64) {
+		memcpy(dst, src, len);
+		return;
+	}
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+	while (len >= 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+		d += 64;
+		s += 64;
+		len -= 64;
+	}
+	memcpy(d, s, len);
+	_mm_sfence();
+#else
+	memcpy(dst, src, len);
+#endif
+}
+
+/*
+ * Send pacing.  Each send gets a slot, evenly spaced on the monotonic
+ * clock.  pacer_wait() sleeps (clock_nanosleep) until shortly before the
+ * slot and spins for the rest, since a sleep can overshoot by tens of
+ * microseconds.  Slots are never moved: after a stall, the missed slots
+ * are already due and go out back to back until the sender catches up.
+ * With a schedule (pacer_init_schedule()), slot N is due schedule[N] ns
+ * after slot 0 instead.
+ */
+#define PACER_SPIN_NS 50000		/* Spin, rather than sleep, for the last 50 usec */
+
+typedef struct pacer_stct {
+	double interval_ns;		/* Nominal gap between sends */
+	lbm_uint64_t start_ns;		/* Time of slot 0 */
+	lbm_uint64_t slot;		/* Slot of the next send */
+	lbm_uint64_t first_ns;		/* Release time of the first send */
+	lbm_uint64_t last_ns;		/* Release time of the latest send */
+	lbm_uint64_t late;		/* Sends released after their slot had passed */
+	lbm_uint64_t max_late_ns;	/* Furthest behind the schedule a send was */
+	lbm_uint64_t gap_min_ns, gap_max_ns;
+	double gap_sum, gap_sumsq;	/* Inter-send gaps, for the jitter */
+	const lbm_uint64_t *schedule;	/* Due time of each slot, ns after slot 0; NULL: even */
+	lbm_uint64_t schedule_len;	/* Entries in schedule */
+} pacer_t;
+
+void pacer_init(pacer_t *p, double msgs_per_sec)
+{
+	memset(p, 0, sizeof(*p));
+	p->interval_ns = 1000000000.0 / msgs_per_sec;
+	p->gap_min_ns = (lbm_uint64_t)-1;
+}
+
+/* Pace to a precomputed schedule (see traffic_schedule_build()) */
+void pacer_init_schedule(pacer_t *p, const lbm_uint64_t *schedule, lbm_uint64_t len)
+{
+	memset(p, 0, sizeof(*p));
+	p->schedule = schedule;
+	p->schedule_len = len;
+	/* the mean gap, for reporting and for judging lateness */
+	p->interval_ns = (len > 1) ? (double)schedule[len - 1] / (double)(len - 1) : 1.0;
+	if (p->interval_ns < 1.0)
+		p->interval_ns = 1.0;
+	p->gap_min_ns = (lbm_uint64_t)-1;
+}
+
+/* Sleep until about "when" (monotonic ns); may return early, never much late */
+void pacer_sleep_until(lbm_uint64_t when)
+{
+#if defined(_WIN32)
+	lbm_uint64_t now = current_ns();
+
+	/* Sleep() has millisecond granularity; leave the last 2 ms to the spin */
+	if (when > now + 2000000)
+		Sleep((DWORD)((when - now) / 1000000) - 1);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(when / 1000000000);
+	ts.tv_nsec = (long)(when % 1000000000);
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);	/* if interrupted, the spin finishes */
+#endif /* _WIN32 */
+}
+
+/* Wait for the next send slot; returns the time the send was released */
+lbm_uint64_t pacer_wait(pacer_t *p)
+{
+	lbm_uint64_t target, now = current_ns();
+
+	if (p->slot == 0) {
+		p->start_ns = now;
+		target = now;
+	} else if (p->schedule != NULL) {
+		target = p->start_ns + p->schedule[(p->slot < p->schedule_len) ? p->slot : p->schedule_len - 1];
+	} else {
+		target = p->start_ns + (lbm_uint64_t)((double)p->slot * p->interval_ns);
+	}
+	if (now < target) {
+		if (target - now > PACER_SPIN_NS)
+			pacer_sleep_until(target - PACER_SPIN_NS);
+		while ((now = current_ns()) < target)
+			;
+	} else if (p->slot > 0 && now - target > (lbm_uint64_t)p->interval_ns) {
+		p->late++;
+		if (now - target > p->max_late_ns)
+			p->max_late_ns = now - target;
+	}
+
+	if (p->slot == 0) {
+		p->first_ns = now;
+	} else {
+		lbm_uint64_t gap = now - p->last_ns;
+
+		p->gap_sum += (double)gap;
+		p->gap_sumsq += (double)gap * (double)gap;
+		if (gap < p->gap_min_ns)
+			p->gap_min_ns = gap;
+		if (gap > p->gap_max_ns)
+			p->gap_max_ns = gap;
+	}
+	p->last_ns = now;
+	p->slot++;
+	return now;
+}
+
+/* Print the requested and achieved rates, and the inter-send gap jitter */
+void pacer_print(FILE *fp, const pacer_t *p)
+{
+	double gaps = (double)(p->slot - 1);
+	double mean, stddev;
+
+	if (p->slot < 2)
+		return;
+	mean = p->gap_sum / gaps;
+	stddev = sqrt(fabs(p->gap_sumsq / gaps - mean * mean));
+	fprintf(fp, "Pacing: requested %.0f msgs/sec%s, achieved %.0f msgs/sec\n",
+			1000000000.0 / p->interval_ns, (p->schedule != NULL) ? " (schedule mean)" : "", gaps * 1000000000.0 / (double)(p->last_ns - p->first_ns));
+	fprintf(fp, "Pacing: inter-send gap usec avg %.3f, jitter (stddev) %.3f, min %.3f, max %.3f\n",
+			mean / 1000.0, stddev / 1000.0, (double)p->gap_min_ns / 1000.0, (double)p->gap_max_ns / 1000.0);
+	fprintf(fp, "Pacing: %" PRIu64 " sends more than one gap behind schedule (max %.3f usec behind)\n",
+			p->late, (double)p->max_late_ns / 1000.0);
+	fflush(fp);
+}
+
+/* xorshift64* generator, for pre-sampling outside the timed loop */
+lbm_uint64_t rand64_next(lbm_uint64_t *state)
+{
+	lbm_uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (x * 0x2545f4914f6cdd1dULL);
+}
+
+/* Seed state for rand64_next(); any seed, including 0, gives a usable state */
+void rand64_seed(lbm_uint64_t *state, lbm_uint64_t seed)
+{
+	*state = seed * 2654435761ULL + 0x9e3779b97f4a7c15ULL;
+}
+
+/* Uniform in [0,1) */
+double rand_unit(lbm_uint64_t *state)
+{
+	return ((double)(rand64_next(state) >> 11) / 9007199254740992.0);
+}
+
+/*
+ * Open-loop traffic models.  The send times are worked out before the run,
+ * so producing them costs nothing while sending; the sender then follows
+ * the schedule with the pacer whether or not it is keeping up.
+ *   poisson:RATE               exponential gaps, mean RATE msgs/sec
+ *   onoff:RATE,PERIOD,DUTY     RATE msgs/sec for DUTY percent of every
+ *                              PERIOD msec, silent for the rest
+ *   ramp:START,END,SECS        rate rises linearly from START to END over
+ *                              SECS seconds, then holds at END
+ * Rates take the k and m suffixes.
+ */
+#define TRAFFIC_NONE 0
+#define TRAFFIC_POISSON 1
+#define TRAFFIC_ONOFF 2
+#define TRAFFIC_RAMP 3
+
+typedef struct traffic_model_stct {
+	int model;			/* TRAFFIC_... */
+	double rate;			/* poisson: mean; onoff: during on; ramp: start (msgs/sec) */
+	double end_rate;		/* ramp: final rate */
+	double period_ns;		/* onoff: on plus off time */
+	double on_ns;			/* onoff: on time */
+	double ramp_ns;			/* ramp: time to reach end_rate */
+} traffic_model_t;
+
+double traffic_parse_rate(const char *str, char **end)
+{
+	double rate = strtod(str, end);
+
+	if (**end == 'k' || **end == 'K') {
+		rate *= 1000.0;
+		(*end)++;
+	} else if (**end == 'm' || **end == 'M') {
+		rate *= 1000000.0;
+		(*end)++;
+	}
+	return rate;
+}
+
+/* Parse a model spec (see above); returns 0, or -1 if it is not valid */
+int traffic_model_parse(const char *spec, traffic_model_t *m)
+{
+	char *end;
+	double a, b;
+
+	memset(m, 0, sizeof(*m));
+	if (strncmp(spec, "poisson:", 8) == 0) {
+		m->model = TRAFFIC_POISSON;
+		m->rate = traffic_parse_rate(spec + 8, &end);
+		return (*end == '\0' && m->rate > 0.0) ? 0 : -1;
+	}
+	if (strncmp(spec, "onoff:", 6) == 0) {
+		m->model = TRAFFIC_ONOFF;
+		m->rate = traffic_parse_rate(spec + 6, &end);
+		if (*end != ',' || m->rate <= 0.0)
+			return -1;
+		a = strtod(end + 1, &end);
+		if (*end != ',' || a <= 0.0)
+			return -1;
+		b = strtod(end + 1, &end);
+		if (*end != '\0' || b <= 0.0 || b > 100.0)
+			return -1;
+		m->period_ns = a * 1000000.0;
+		m->on_ns = m->period_ns * b / 100.0;
+		return 0;
+	}
+	if (strncmp(spec, "ramp:", 5) == 0) {
+		m->model = TRAFFIC_RAMP;
+		m->rate = traffic_parse_rate(spec + 5, &end);
+		if (*end != ',' || m->rate <= 0.0)
+			return -1;
+		m->end_rate = traffic_parse_rate(end + 1, &end);
+		if (*end != ',' || m->end_rate <= 0.0)
+			return -1;
+		a = strtod(end + 1, &end);
+		if (*end != '\0' || a <= 0.0)
+			return -1;
+		m->ramp_ns = a * 1000000000.0;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Build the schedule for n sends at "scale" times the model's rates (to
+ * share one model between threads); entry i is the due time of send i, in
+ * ns after send 0.  Returns NULL if the array cannot be allocated.
+ */
+lbm_uint64_t *traffic_schedule_build(const traffic_model_t *m, double scale, lbm_uint64_t n, lbm_uint64_t seed)
+{
+	lbm_uint64_t *sched = (lbm_uint64_t *) malloc((size_t)(n ? n : 1) * sizeof(lbm_uint64_t));
+	lbm_uint64_t i, x;
+	double t = 0.0;
+
+	if (sched == NULL)
+		return NULL;
+	rand64_seed(&x, seed);
+	for (i = 0; i < n; i++) {
+		sched[i] = (lbm_uint64_t)t;
+		switch (m->model) {
+		case TRAFFIC_POISSON:
+			t += -log(1.0 - rand_unit(&x)) * 1000000000.0 / (m->rate * scale);
+			break;
+		case TRAFFIC_ONOFF:
+			{
+				double period_start;
+
+				t += 1000000000.0 / (m->rate * scale);
+				period_start = floor(t / m->period_ns) * m->period_ns;
+				if (t - period_start >= m->on_ns)
+					t = period_start + m->period_ns;
+			}
+			break;
+		case TRAFFIC_RAMP:
+			{
+				double rate = m->end_rate;
+
+				if (t < m->ramp_ns)
+					rate = m->rate + (m->end_rate - m->rate) * t / m->ramp_ns;
+				t += 1000000000.0 / (rate * scale);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return sched;
+}
+
+/*
+ * Wakeup for a source that got LBM_EWOULDBLOCK.  The sender arms the gate
+ * before each send and calls send_gate_wait() if the send would block; the
+ * source event callback calls send_gate_open() on LBM_SRC_EVENT_WAKEUP.
+ * The waiter spins for up to spin_ns first (under a rate limit the wakeup
+ * often comes within microseconds), then parks on a condition variable.
+ * A park gives up after 10 ms and lets the sender retry the send, so a
+ * lost wakeup costs no more than the old fixed sleep.
+ */
+#define SEND_GATE_HIST_BUCKETS 24	/* <1 usec, then powers of 2 up to ~4 sec */
+#define SEND_GATE_PARK_MSEC 10
+
+typedef struct send_gate_stct {
+	volatile int blocked;		/* Armed; cleared by the WAKEUP event */
+	lbm_uint64_t spin_ns;		/* How long to spin before parking */
+#if defined(_WIN32)
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE cond;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif /* _WIN32 */
+	lbm_uint64_t blocks;		/* Sends that had to wait */
+	lbm_uint64_t parks;		/* Waits that went past the spin */
+	lbm_uint64_t blocked_ns;	/* Total time spent waiting */
+	lbm_uint64_t max_ns;		/* Longest wait */
+	lbm_uint64_t hist[SEND_GATE_HIST_BUCKETS];
+} send_gate_t;
+
+void send_gate_init(send_gate_t *g, lbm_uint64_t spin_ns)
+{
+	memset(g, 0, sizeof(*g));
+	g->spin_ns = spin_ns;
+#if defined(_WIN32)
+	InitializeCriticalSection(&g->lock);
+	InitializeConditionVariable(&g->cond);
+#else
+	pthread_mutex_init(&g->lock, NULL);
+	pthread_cond_init(&g->cond, NULL);
+#endif /* _WIN32 */
+}
+
+/* Forget the waits so far (e.g. those during a warm-up) */
+void send_gate_clear_stats(send_gate_t *g)
+{
+	g->blocks = 0;
+	g->parks = 0;
+	g->blocked_ns = 0;
+	g->max_ns = 0;
+	memset(g->hist, 0, sizeof(g->hist));
+}
+
+/* Call before each send attempt */
+void send_gate_arm(send_gate_t *g)
+{
+	g->blocked = 1;
+}
+
+/* Call from the source event callback on LBM_SRC_EVENT_WAKEUP */
+void send_gate_open(send_gate_t *g)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(&g->lock);
+	g->blocked = 0;
+	WakeConditionVariable(&g->cond);
+	LeaveCriticalSection(&g->lock);
+#else
+	pthread_mutex_lock(&g->lock);
+	g->blocked = 0;
+	pthread_cond_signal(&g->cond);
+	pthread_mutex_unlock(&g->lock);
+#endif /* _WIN32 */
+}
+
+/* Call after a send returns LBM_EWOULDBLOCK; returns when it is worth retrying */
+void send_gate_wait(send_gate_t *g)
+{
+	lbm_uint64_t start = current_ns(), waited;
+	int bucket = 0;
+
+	while (g->blocked && current_ns() - start < g->spin_ns)
+		;
+	if (g->blocked) {
+#if defined(_WIN32)
+		EnterCriticalSection(&g->lock);
+		if (g->blocked)
+			SleepConditionVariableCS(&g->cond, &g->lock, SEND_GATE_PARK_MSEC);
+		LeaveCriticalSection(&g->lock);
+#else
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += SEND_GATE_PARK_MSEC * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&g->lock);
+		while (g->blocked) {
+			if (pthread_cond_timedwait(&g->cond, &g->lock, &ts) != 0)
+				break;	/* timed out: let the caller retry */
+		}
+		pthread_mutex_unlock(&g->lock);
+#endif /* _WIN32 */
+		g->parks++;
+	}
+
+	waited = current_ns() - start;
+	g->blocks++;
+	g->blocked_ns += waited;
+	if (waited > g->max_ns)
+		g->max_ns = waited;
+	while (bucket < SEND_GATE_HIST_BUCKETS - 1 && waited / 1000 >= ((lbm_uint64_t)1 << bucket))
+		bucket++;
+	g->hist[bucket]++;
+}
+
+/* Print total blocked time and the histogram of wait durations */
+void send_gate_print(FILE *fp, const send_gate_t *g)
+{
+	int i;
+
+	if (g->blocks == 0)
+		return;
+	fprintf(fp, "Blocked %" PRIu64 " times (%" PRIu64 " parked), total %.3f msec, max %.3f msec\n",
+			g->blocks, g->parks, (double)g->blocked_ns / 1000000.0, (double)g->max_ns / 1000000.0);
+	for (i = 0; i < SEND_GATE_HIST_BUCKETS; i++) {
+		if (g->hist[i] == 0)
+			continue;
+		if (i == 0)
+			fprintf(fp, "  blocked      < 1 usec: %" PRIu64 "\n", g->hist[i]);
+		else
+			fprintf(fp, "  blocked < %8lu usec: %" PRIu64 "\n", 1UL << i, g->hist[i]);
+	}
+	fflush(fp);
+}
+
+/*
+ * Waiting for receivers (--wait-receivers=N[,SECS]).  The source event
+ * callback keeps a count of attached receivers, connects less disconnects,
+ * and the sender polls it instead of sleeping a fixed -d; the time until
+ * enough receivers are attached is reported as a startup metric.
+ */
+#define RCV_WAIT_POLL_NS 1000000
+
+typedef struct rcv_wait_stct {
+	int needed;			/* Receivers to wait for (0: use -d instead) */
+	int timeout_sec;		/* Give up after this long (0: wait forever) */
+	lbm_uint64_t start_ns;		/* When rcv_wait_start() was called */
+} rcv_wait_t;
+
+/* Parse "N[,SECS]"; returns 0, or -1 if it is not valid */
+int rcv_wait_parse(const char *arg, rcv_wait_t *w)
+{
+	char *end;
+
+	memset(w, 0, sizeof(*w));
+	w->needed = (int) strtol(arg, &end, 10);
+	if (end == arg || w->needed < 1)
+		return -1;
+	if (*end == ',') {
+		arg = end + 1;
+		w->timeout_sec = (int) strtol(arg, &end, 10);
+		if (end == arg || w->timeout_sec < 0)
+			return -1;
+	}
+	return (*end == '\0') ? 0 : -1;
+}
+
+/* Start the clock for the time-to-ready (and the timeout) */
+void rcv_wait_start(rcv_wait_t *w)
+{
+	w->start_ns = current_ns();
+}
+
+/*
+ * Wait until *connected reaches w->needed.  Returns 0, or -1 if the timeout
+ * (counted from rcv_wait_start()) passes first.
+ */
+int rcv_wait_for(const rcv_wait_t *w, volatile int *connected)
+{
+	lbm_uint64_t deadline = w->start_ns + (lbm_uint64_t)w->timeout_sec * 1000000000;
+
+	while (*connected < w->needed) {
+		if (w->timeout_sec > 0 && current_ns() >= deadline)
+			return -1;
+		pacer_sleep_until(current_ns() + RCV_WAIT_POLL_NS);
+	}
+	return 0;
+}
+
+/* Report the time-to-ready */
+void rcv_wait_print(FILE *fp, const rcv_wait_t *w, const char *what)
+{
+	fprintf(fp, "Ready: %d %s after %.3f msec\n", w->needed, what,
+			(double)(current_ns() - w->start_ns) / 1000000.0);
+	fflush(fp);
+}
+
+/*
+ * Latency histogram, log-linear in the style of HdrHistogram: values below
+ * LAT_HIST_SUB_COUNT get a bucket each, and every power of 2 above that is
+ * split into LAT_HIST_SUB_COUNT equal buckets, so any value is reported to
+ * within about 3%.  Recording is an index calculation and two stores, cheap
+ * enough to time every send.  One thread records; another may print, taking
+ * the interval as the difference from the counts it saw last time.
+ */
+#define LAT_HIST_SUB_BITS 5
+#define LAT_HIST_SUB_COUNT (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS ((64 - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB_COUNT)
+
+typedef struct lat_hist_stct {
+	lbm_uint64_t max;		/* Largest value recorded */
+	lbm_uint64_t interval_max;	/* Largest since the last lat_hist_print_interval() */
+	lbm_uint64_t buckets[LAT_HIST_BUCKETS];
+} lat_hist_t;
+
+int lat_hist_index(lbm_uint64_t v)
+{
+	int msb = 0;
+
+	if (v < LAT_HIST_SUB_COUNT)
+		return (int)v;
+#if defined(__GNUC__)
+	msb = 63 - __builtin_clzll(v);
+#else
+	{
+		lbm_uint64_t t = v;
+
+		while (t >>= 1)
+			msb++;
+	}
+#endif
+	return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB_COUNT +
+		(int)(v >> (msb - LAT_HIST_SUB_BITS)) - LAT_HIST_SUB_COUNT;
+}
+
+/* Largest value that lands in bucket idx */
+lbm_uint64_t lat_hist_bucket_top(int idx)
+{
+	int shift;
+	lbm_uint64_t sub;
+
+	if (idx < LAT_HIST_SUB_COUNT)
+		return (lbm_uint64_t)idx;
+	shift = idx / LAT_HIST_SUB_COUNT - 1;
+	sub = (lbm_uint64_t)(idx % LAT_HIST_SUB_COUNT + LAT_HIST_SUB_COUNT);
+	return ((sub + 1) << shift) - 1;
+}
+
+void lat_hist_init(lat_hist_t *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void lat_hist_record(lat_hist_t *h, lbm_uint64_t v)
+{
+	h->buckets[lat_hist_index(v)]++;
+	if (v > h->interval_max) {
+		h->interval_max = v;
+		if (v > h->max)
+			h->max = v;
+	}
+}
+
+/* Add the counts in src to dst */
+void lat_hist_merge(lat_hist_t *dst, const lat_hist_t *src)
+{
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/* Value at percentile pct (0 to 100) of everything recorded, or 0 if nothing was */
+lbm_uint64_t lat_hist_percentile(const lat_hist_t *h, double pct)
+{
+	lbm_uint64_t n = 0, cum = 0, rank;
+	int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		n += h->buckets[i];
+	if (n == 0)
+		return 0;
+	rank = (lbm_uint64_t)ceil(pct / 100.0 * (double)n);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		cum += h->buckets[i];
+		if (cum >= rank) {
+			lbm_uint64_t v = lat_hist_bucket_top(i);
+
+			return (v < h->max) ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/*
+ * Print the count, percentiles to p99.99, and max on one line.  With base,
+ * only what was recorded since base was copied from h is counted.
+ */
+void lat_hist_print(FILE *fp, const char *label, const lat_hist_t *h, const lat_hist_t *base, lbm_uint64_t max)
+{
+	static const double pcts[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+	static const char *pct_names[] = { "p50", "p90", "p99", "p99.9", "p99.99" };
+	lbm_uint64_t n = 0, cum = 0, rank;
+	int i, p = 0;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		n += h->buckets[i] - (base ? base->buckets[i] : 0);
+	fprintf(fp, "%s: %" PRIu64 " calls", label, n);
+	if (n == 0) {
+		fprintf(fp, "\n");
+		return;
+	}
+	rank = (lbm_uint64_t)ceil(pcts[0] / 100.0 * (double)n);
+	for (i = 0; i < LAT_HIST_BUCKETS && p < 5; i++) {
+		cum += h->buckets[i] - (base ? base->buckets[i] : 0);
+		while (p < 5 && cum >= rank) {
+			lbm_uint64_t v = lat_hist_bucket_top(i);
+
+			fprintf(fp, ", %s %" PRIu64, pct_names[p], (v < max) ? v : max);
+			if (++p < 5) {
+				rank = (lbm_uint64_t)ceil(pcts[p] / 100.0 * (double)n);
+				if (rank < 1)
+					rank = 1;
+			}
+		}
+	}
+	fprintf(fp, ", max %" PRIu64 "\n", max);
+	fflush(fp);
+}
+
+/* Print what was recorded since the last call (base holds the previous counts) */
+void lat_hist_print_interval(FILE *fp, const char *label, lat_hist_t *h, lat_hist_t *base)
+{
+	lbm_uint64_t max = h->interval_max;
+
+	h->interval_max = 0;
+	lat_hist_print(fp, label, h, base, max);
+	memcpy(base->buckets, h->buckets, sizeof(base->buckets));
+}
+
+/*
+ * Message size distributions.  The sizes are drawn before the run into an
+ * array of SIZE_DIST_SAMPLES, and the sender takes the next one each send,
+ * so no random numbers are generated while sending.
+ *   SIZE:WEIGHT,...            fixed sizes in proportion to their weights
+ *   uniform:MIN,MAX            any size from MIN to MAX bytes
+ *   lognormal:MEDIAN,SIGMA[,MAX]  log of the size is normal; capped at MAX
+ *                              [65536]
+ *   file:PATH                  "SIZE WEIGHT" lines, as from a histogram of
+ *                              a production feed (# starts a comment)
+ * Weighted sizes are placed in exact proportion and then shuffled.
+ */
+#define SIZE_DIST_SAMPLES 65536		/* power of 2 */
+#define SIZE_DIST_MAX_SIZES 1024	/* entries in a weighted list */
+#define SIZE_DIST_BUCKETS 33		/* powers of 2 for reporting */
+
+typedef struct size_dist_stct {
+	size_t *sizes;			/* SIZE_DIST_SAMPLES pre-sampled sizes */
+	size_t min, max;		/* Smallest and largest sample */
+	double mean;			/* Mean of the samples */
+	unsigned int raised;		/* Samples raised to the caller's minimum */
+} size_dist_t;
+
+/* Per sender counts, by power of 2 size bucket */
+typedef struct size_stats_stct {
+	lbm_uint64_t msgs[SIZE_DIST_BUCKETS];
+	lbm_uint64_t bytes[SIZE_DIST_BUCKETS];
+} size_stats_t;
+
+#define SIZE_DIST_NEXT(_d, _n) ((_d)->sizes[(_n) & (SIZE_DIST_SAMPLES - 1)])
+
+/* Bucket b holds sizes 2^b to 2^(b+1)-1 (bucket 0 also holds 0) */
+int size_dist_bucket(size_t len)
+{
+	int b = 0;
+
+	while (len > 1 && b < SIZE_DIST_BUCKETS - 1) {
+		len >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void size_stats_add(size_stats_t *st, size_t len)
+{
+	int b = size_dist_bucket(len);
+
+	st->msgs[b]++;
+	st->bytes[b] += len;
+}
+
+/* Add the counts in src to dst */
+void size_stats_merge(size_stats_t *dst, const size_stats_t *src)
+{
+	int b;
+
+	for (b = 0; b < SIZE_DIST_BUCKETS; b++) {
+		dst->msgs[b] += src->msgs[b];
+		dst->bytes[b] += src->bytes[b];
+	}
+}
+
+/* Print the overall and per-bucket message and byte rates over secs seconds */
+void size_stats_print(FILE *fp, const size_stats_t *st, double secs)
+{
+	lbm_uint64_t msgs = 0, bytes = 0;
+	int b;
+
+	for (b = 0; b < SIZE_DIST_BUCKETS; b++) {
+		msgs += st->msgs[b];
+		bytes += st->bytes[b];
+	}
+	if (msgs == 0 || secs <= 0.0)
+		return;
+	fprintf(fp, "Sizes: mean %.1f bytes, %.5g msgs/sec, %.5g bytes/sec\n",
+			(double)bytes / (double)msgs, (double)msgs / secs, (double)bytes / secs);
+	for (b = 0; b < SIZE_DIST_BUCKETS; b++) {
+		if (st->msgs[b] == 0)
+			continue;
+		fprintf(fp, "  %10lu-%-10lu %12" PRIu64 " msgs (%5.1f%%), %.5g msgs/sec, %.5g bytes/sec\n",
+				(unsigned long)(b ? (1UL << b) : 0), (unsigned long)((2UL << b) - 1),
+				st->msgs[b], 100.0 * (double)st->msgs[b] / (double)msgs,
+				(double)st->msgs[b] / secs, (double)st->bytes[b] / secs);
+	}
+	fflush(fp);
+}
+
+/* Read "SIZE WEIGHT" lines; returns the number of entries, or -1 */
+int size_dist_read_file(const char *path, size_t *sizes, double *weights, int max)
+{
+	FILE *fp = fopen(path, "r");
+	char line[256];
+	int n = 0, lineno = 0;
+
+	if (fp == NULL) {
+		fprintf(stderr, "size distribution: ");
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *p = line;
+		unsigned long size;
+		double weight;
+
+		lineno++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+			continue;
+		if (sscanf(p, "%lu %lf", &size, &weight) != 2 || size == 0 || weight < 0.0) {
+			fprintf(stderr, "%s:%d: expected SIZE WEIGHT\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		if (n >= max) {
+			fprintf(stderr, "%s: more than %d sizes\n", path, max);
+			fclose(fp);
+			return -1;
+		}
+		sizes[n] = (size_t)size;
+		weights[n] = weight;
+		n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+/* Parse "SIZE:WEIGHT,..."; returns the number of entries, or -1 */
+int size_dist_parse_weights(const char *spec, size_t *sizes, double *weights, int max)
+{
+	const char *p = spec;
+	char *end;
+	int n = 0;
+
+	while (*p != '\0') {
+		if (n >= max)
+			return -1;
+		sizes[n] = (size_t)strtoul(p, &end, 10);
+		if (end == p || *end != ':' || sizes[n] == 0)
+			return -1;
+		p = end + 1;
+		weights[n] = strtod(p, &end);
+		if (end == p || (*end != ',' && *end != '\0') || weights[n] < 0.0)
+			return -1;
+		p = (*end == ',') ? end + 1 : end;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Build d from spec (see above), raising any size below minlen to minlen.
+ * Prints the problem and returns -1 if the spec is not valid.
+ */
+int size_dist_create(size_dist_t *d, const char *spec, size_t minlen, lbm_uint64_t seed)
+{
+	size_t *sizes = (size_t *) malloc(SIZE_DIST_MAX_SIZES * sizeof(size_t));
+	double *weights = (double *) malloc(SIZE_DIST_MAX_SIZES * sizeof(double));
+	lbm_uint64_t x;
+	double total = 0.0;
+	int n = 0, i, rc = -1;
+	unsigned int s;
+
+	memset(d, 0, sizeof(*d));
+	d->sizes = (size_t *) malloc(SIZE_DIST_SAMPLES * sizeof(size_t));
+	if (sizes == NULL || weights == NULL || d->sizes == NULL) {
+		fprintf(stderr, "size distribution: could not allocate memory\n");
+		goto done;
+	}
+	rand64_seed(&x, seed);
+
+	if (strncmp(spec, "uniform:", 8) == 0) {
+		unsigned long lo, hi;
+		char c;
+
+		if (sscanf(spec + 8, "%lu,%lu%c", &lo, &hi, &c) != 2 || lo == 0 || hi < lo) {
+			fprintf(stderr, "size distribution: expected uniform:MIN,MAX\n");
+			goto done;
+		}
+		for (s = 0; s < SIZE_DIST_SAMPLES; s++)
+			d->sizes[s] = (size_t)(lo + (unsigned long)(rand_unit(&x) * (double)(hi - lo + 1)));
+	} else if (strncmp(spec, "lognormal:", 10) == 0) {
+		double median, sigma;
+		unsigned long cap = 65536;
+		char c;
+		int nf = sscanf(spec + 10, "%lf,%lf,%lu%c", &median, &sigma, &cap, &c);
+
+		if ((nf != 2 && nf != 3) || median < 1.0 || sigma < 0.0 || cap < 1) {
+			fprintf(stderr, "size distribution: expected lognormal:MEDIAN,SIGMA[,MAX]\n");
+			goto done;
+		}
+		for (s = 0; s < SIZE_DIST_SAMPLES; s++) {
+			/* Box-Muller; 1-u keeps the log argument above 0 */
+			double z = sqrt(-2.0 * log(1.0 - rand_unit(&x))) * cos(2.0 * 3.14159265358979323846 * rand_unit(&x));
+			double v = floor(median * exp(sigma * z) + 0.5);
+
+			d->sizes[s] = (v < 1.0) ? 1 : (v > (double)cap) ? (size_t)cap : (size_t)v;
+		}
+	} else {
+		lbm_uint64_t placed = 0;
+
+		if (strncmp(spec, "file:", 5) == 0) {
+			n = size_dist_read_file(spec + 5, sizes, weights, SIZE_DIST_MAX_SIZES);
+			if (n < 0)
+				goto done;
+		} else {
+			n = size_dist_parse_weights(spec, sizes, weights, SIZE_DIST_MAX_SIZES);
+			if (n < 0) {
+				fprintf(stderr, "size distribution: expected SIZE:WEIGHT,... uniform:, lognormal: or file:\n");
+				goto done;
+			}
+		}
+		for (i = 0; i < n; i++)
+			total += weights[i];
+		if (n == 0 || total <= 0.0) {
+			fprintf(stderr, "size distribution: no sizes with a positive weight\n");
+			goto done;
+		}
+		/* Exact proportions (cumulative rounding), then a Fisher-Yates shuffle */
+		for (i = 0; i < n; i++) {
+			double cum = 0.0;
+			lbm_uint64_t upto;
+			int j;
+
+			for (j = 0; j <= i; j++)
+				cum += weights[j];
+			upto = (i == n - 1) ? SIZE_DIST_SAMPLES :
+				(lbm_uint64_t)floor(cum / total * SIZE_DIST_SAMPLES + 0.5);
+			while (placed < upto)
+				d->sizes[placed++] = sizes[i];
+		}
+		for (s = SIZE_DIST_SAMPLES - 1; s > 0; s--) {
+			unsigned int j = (unsigned int)(rand64_next(&x) % (s + 1));
+			size_t t = d->sizes[s];
+
+			d->sizes[s] = d->sizes[j];
+			d->sizes[j] = t;
+		}
+	}
+
+	total = 0.0;
+	d->min = (size_t)-1;
+	for (s = 0; s < SIZE_DIST_SAMPLES; s++) {
+		if (d->sizes[s] < minlen) {
+			d->sizes[s] = minlen;
+			d->raised++;
+		}
+		if (d->sizes[s] < d->min)
+			d->min = d->sizes[s];
+		if (d->sizes[s] > d->max)
+			d->max = d->sizes[s];
+		total += (double)d->sizes[s];
+	}
+	d->mean = total / SIZE_DIST_SAMPLES;
+	rc = 0;
+
+done:
+	free(sizes);
+	free(weights);
+	if (rc != 0) {
+		free(d->sizes);
+		d->sizes = NULL;
+	}
+	return rc;
+}
+
+void size_dist_delete(size_dist_t *d)
+{
+	free(d->sizes);
+	d->sizes = NULL;
+}
+
+/*
+ * Warm-up and measurement windows.  A warm-up is given as a message count
+ * ("NUM") or a time ("NUMs" or "NUMms"), and is left out of the results.
+ * The measured part of the run is then cut into windows, and the run is at
+ * steady state from the first window after which the message rates vary by
+ * no more than a limit (coefficient of variation, stddev / mean), judged
+ * over at least MEAS_STEADY_MIN_WINDOWS windows.
+ */
+#define MEAS_MAX_WINDOWS 1000
+#define MEAS_STEADY_MIN_WINDOWS 3
+#define MEAS_DEFAULT_CV_PCT 5.0
+
+typedef struct meas_windows_stct {
+	int n;				/* Windows recorded */
+	double cv_limit;		/* Steady at or below this CV (a fraction, not percent) */
+	lbm_uint64_t msgs[MEAS_MAX_WINDOWS];
+	lbm_uint64_t bytes[MEAS_MAX_WINDOWS];
+	double secs[MEAS_MAX_WINDOWS];
+} meas_windows_t;
+
+/* Parse a warm-up spec (see above); returns 0, or -1 if it is not valid */
+int warmup_parse(const char *arg, lbm_uint64_t *msgs, lbm_uint64_t *ns)
+{
+	char *end;
+	double v = strtod(arg, &end);
+
+	*msgs = 0;
+	*ns = 0;
+	if (end == arg || v <= 0.0)
+		return -1;
+	if (strcmp(end, "s") == 0)
+		*ns = (lbm_uint64_t)(v * 1000000000.0);
+	else if (strcmp(end, "ms") == 0)
+		*ns = (lbm_uint64_t)(v * 1000000.0);
+	else if (*end == '\0' && v == floor(v))
+		*msgs = (lbm_uint64_t)v;
+	else
+		return -1;
+	return 0;
+}
+
+void meas_windows_init(meas_windows_t *mw, double cv_pct)
+{
+	memset(mw, 0, sizeof(*mw));
+	mw->cv_limit = cv_pct / 100.0;
+}
+
+/* Record a finished window; windows past MEAS_MAX_WINDOWS are dropped */
+void meas_window_add(meas_windows_t *mw, lbm_uint64_t msgs, lbm_uint64_t bytes, double secs)
+{
+	if (mw->n >= MEAS_MAX_WINDOWS)
+		return;
+	mw->msgs[mw->n] = msgs;
+	mw->bytes[mw->n] = bytes;
+	mw->secs[mw->n] = secs;
+	mw->n++;
+}
+
+/*
+ * Add the windows of a concurrent sender in src to dst: the counts add up,
+ * and each window lasts as long as the slower of the two.
+ */
+void meas_windows_merge(meas_windows_t *dst, const meas_windows_t *src)
+{
+	int i;
+
+	for (i = 0; i < src->n; i++) {
+		dst->msgs[i] += src->msgs[i];
+		dst->bytes[i] += src->bytes[i];
+		if (src->secs[i] > dst->secs[i])
+			dst->secs[i] = src->secs[i];
+	}
+	if (src->n > dst->n)
+		dst->n = src->n;
+}
+
+/* Coefficient of variation of the message rates of windows first to n-1 */
+double meas_windows_cv(const meas_windows_t *mw, int first)
+{
+	double sum = 0.0, sumsq = 0.0, mean, rate;
+	int i, n = mw->n - first;
+
+	if (n < 2)
+		return 0.0;
+	for (i = first; i < mw->n; i++) {
+		rate = (mw->secs[i] > 0.0) ? (double)mw->msgs[i] / mw->secs[i] : 0.0;
+		sum += rate;
+		sumsq += rate * rate;
+	}
+	mean = sum / n;
+	if (mean <= 0.0)
+		return 0.0;
+	return sqrt(fabs(sumsq / n - mean * mean)) / mean;
+}
+
+/*
+ * First window from which the run is at steady state, or -1 if it never
+ * gets there (or has too few windows to tell).
+ */
+int meas_windows_steady(const meas_windows_t *mw)
+{
+	int first;
+
+	for (first = 0; first + MEAS_STEADY_MIN_WINDOWS <= mw->n; first++) {
+		if (meas_windows_cv(mw, first) <= mw->cv_limit)
+			return first;
+	}
+	return -1;
+}
+
+/* Print each window's rates, then the steady state verdict */
+void meas_windows_print(FILE *fp, const meas_windows_t *mw)
+{
+	int i, steady;
+
+	for (i = 0; i < mw->n; i++) {
+		double secs = (mw->secs[i] > 0.0) ? mw->secs[i] : 1e-9;
+
+		fprintf(fp, "Window %d: %" PRIu64 " msgs in %.4g secs, %.5g msgs/sec, %.5g bytes/sec\n",
+				i + 1, mw->msgs[i], mw->secs[i], (double)mw->msgs[i] / secs, (double)mw->bytes[i] / secs);
+	}
+	if (mw->n < MEAS_STEADY_MIN_WINDOWS) {
+		fprintf(fp, "Steady state: not judged, fewer than %d windows\n", MEAS_STEADY_MIN_WINDOWS);
+	} else if ((steady = meas_windows_steady(mw)) >= 0) {
+		fprintf(fp, "Steady state: from window %d, rate CV %.2f%% over the last %d windows (limit %.2f%%)\n",
+				steady + 1, 100.0 * meas_windows_cv(mw, steady), mw->n - steady, 100.0 * mw->cv_limit);
+		if (steady > 0)
+			fprintf(fp, "Steady state: the first %d window%s should be counted as warm-up\n",
+					steady, (steady > 1) ? "s" : "");
+	} else {
+		fprintf(fp, "Steady state: NOT REACHED, rate CV %.2f%% over the last %d windows (limit %.2f%%)\n",
+				100.0 * meas_windows_cv(mw, mw->n - MEAS_STEADY_MIN_WINDOWS),
+				MEAS_STEADY_MIN_WINDOWS, 100.0 * mw->cv_limit);
+	}
+	fflush(fp);
+}
+
+/*
+ * Loss schedules, for lbm_set_lbtrm_src_loss_rate() and friends.  A file
+ * of phases, each starting SECS seconds after the schedule does and lasting
+ * until the next one:
+ *   SECS rate PCT                       drop PCT percent of datagrams
+ *   SECS burst GOOD_MS BAD_MS [BAD_PCT [GOOD_PCT]]
+ *                                       Gilbert-Elliott: alternate between a
+ *                                       good state (GOOD_PCT loss [0]) and a
+ *                                       bad one (BAD_PCT [100]), staying in
+ *                                       each for a random time with mean
+ *                                       GOOD_MS and BAD_MS
+ *   SECS blackout PERIOD_MS DARK_MS     drop everything for the first DARK_MS
+ *                                       of every PERIOD_MS
+ * Blank lines and lines starting with # are ignored.  The loss rate only
+ * takes whole percents and is set from a timer, so burst and blackout edges
+ * fall on LOSS_SCHED_TICK_MSEC boundaries.
+ */
+#define LOSS_SCHED_MAX_PHASES 256
+#define LOSS_SCHED_TICK_MSEC 10
+
+#define LOSS_RATE 0
+#define LOSS_BURST 1
+#define LOSS_BLACKOUT 2
+
+typedef struct loss_phase_stct {
+	lbm_uint64_t start_ns;		/* After the schedule starts */
+	int model;			/* LOSS_RATE, LOSS_BURST or LOSS_BLACKOUT */
+	int pct;			/* Loss: rate; burst: bad state; blackout: while dark */
+	int good_pct;			/* burst: loss in the good state */
+	double good_ns, bad_ns;		/* burst: mean time in each state */
+	lbm_uint64_t period_ns;		/* blackout: one dark and light cycle */
+	lbm_uint64_t dark_ns;		/* blackout: dark time at the start of each cycle */
+} loss_phase_t;
+
+typedef struct loss_sched_stct {
+	loss_phase_t phases[LOSS_SCHED_MAX_PHASES];
+	int nphases;
+	int phase;			/* Phase in effect */
+	int bad;			/* burst: in the bad state */
+	int pct;			/* Loss rate last returned */
+	lbm_uint64_t start_ns;		/* When the schedule started */
+	lbm_uint64_t last_ns;		/* Time of the last loss_sched_pct() */
+	lbm_uint64_t rng;		/* rand64_next() state, for burst */
+	lbm_uint64_t changes;		/* Times the loss rate changed */
+	lbm_uint64_t lossy_ns;		/* Time spent with some loss */
+} loss_sched_t;
+
+const char *loss_model_names[] = { "rate", "burst", "blackout" };
+
+/* Read a schedule from path; returns 0, or -1 (after saying why) */
+int loss_sched_read(loss_sched_t *ls, const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char line[256];
+	int lineno = 0;
+
+	memset(ls, 0, sizeof(*ls));
+	if (fp == NULL) {
+		fprintf(stderr, "loss schedule: ");
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		loss_phase_t *ph = &ls->phases[ls->nphases];
+		char *p = line, model[16];
+		double secs, a = 0.0, b = 0.0;
+		int c = 100, d = 0, n;
+
+		lineno++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+			continue;
+		if (ls->nphases >= LOSS_SCHED_MAX_PHASES) {
+			fprintf(stderr, "%s: more than %d phases\n", path, LOSS_SCHED_MAX_PHASES);
+			fclose(fp);
+			return -1;
+		}
+		memset(ph, 0, sizeof(*ph));
+		n = sscanf(p, "%lf %15s %lf %lf %d %d", &secs, model, &a, &b, &c, &d);
+		if (n < 3 || secs < 0.0 ||
+			(ls->nphases > 0 && (lbm_uint64_t)(secs * 1000000000.0) < ls->phases[ls->nphases - 1].start_ns)) {
+			fprintf(stderr, "%s:%d: expected SECS MODEL ARGS, in time order\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		ph->start_ns = (lbm_uint64_t)(secs * 1000000000.0);
+		if (strcmp(model, "rate") == 0 && n == 3 && a >= 0.0 && a <= 100.0 && a == (double)(int)a) {
+			ph->model = LOSS_RATE;
+			ph->pct = (int)a;
+		} else if (strcmp(model, "burst") == 0 && n >= 4 && a > 0.0 && b > 0.0 &&
+				c >= 0 && c <= 100 && d >= 0 && d <= 100) {
+			ph->model = LOSS_BURST;
+			ph->good_ns = a * 1000000.0;
+			ph->bad_ns = b * 1000000.0;
+			ph->pct = c;
+			ph->good_pct = d;
+		} else if (strcmp(model, "blackout") == 0 && n == 4 && (lbm_uint64_t)(a * 1000000.0) > 0 &&
+				b >= 0.0 && b <= a) {
+			ph->model = LOSS_BLACKOUT;
+			ph->period_ns = (lbm_uint64_t)(a * 1000000.0);
+			ph->dark_ns = (lbm_uint64_t)(b * 1000000.0);
+			ph->pct = 100;
+		} else {
+			fprintf(stderr, "%s:%d: expected 'rate PCT' (whole percent), 'burst GOOD_MS BAD_MS [BAD_PCT [GOOD_PCT]]'"
+				" or 'blackout PERIOD_MS DARK_MS'\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		ls->nphases++;
+	}
+	fclose(fp);
+	if (ls->nphases == 0) {
+		fprintf(stderr, "%s: no phases\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Start the schedule's clock; seed is for the burst model */
+void loss_sched_start(loss_sched_t *ls, lbm_uint64_t now, lbm_uint64_t seed)
+{
+	ls->start_ns = ls->last_ns = now;
+	ls->phase = -1;
+	ls->bad = 0;
+	ls->pct = 0;
+	ls->changes = 0;
+	ls->lossy_ns = 0;
+	rand64_seed(&ls->rng, seed);
+}
+
+/*
+ * The loss rate that should be in effect now (0 before the first phase).
+ * Call it every tick: the burst model moves between its states as time
+ * passes between calls.
+ */
+int loss_sched_pct(loss_sched_t *ls, lbm_uint64_t now)
+{
+	lbm_uint64_t t = now - ls->start_ns, dt = now - ls->last_ns;
+	loss_phase_t *ph;
+	int pct = 0;
+
+	if (ls->pct > 0)
+		ls->lossy_ns += dt;
+	ls->last_ns = now;
+	while (ls->phase + 1 < ls->nphases && ls->phases[ls->phase + 1].start_ns <= t) {
+		ls->phase++;
+		ls->bad = 0;
+	}
+	if (ls->phase < 0)
+		return 0;
+	ph = &ls->phases[ls->phase];
+	switch (ph->model) {
+	case LOSS_RATE:
+		pct = ph->pct;
+		break;
+	case LOSS_BURST:
+		/* Leave the state with probability 1 - exp(-dt / mean time in it) */
+		if (rand_unit(&ls->rng) < 1.0 - exp(-(double)dt / (ls->bad ? ph->bad_ns : ph->good_ns)))
+			ls->bad = !ls->bad;
+		pct = ls->bad ? ph->pct : ph->good_pct;
+		break;
+	case LOSS_BLACKOUT:
+		pct = ((t - ph->start_ns) % ph->period_ns < ph->dark_ns) ? ph->pct : 0;
+		break;
+	}
+	if (pct != ls->pct)
+		ls->changes++;
+	ls->pct = pct;
+	return pct;
+}
+
+void loss_sched_print(FILE *fp, const loss_sched_t *ls)
+{
+	fprintf(fp, "Loss schedule: %" PRIu64 " changes, some loss for %.3f of %.3f seconds\n",
+		ls->changes, (double)ls->lossy_ns / 1000000000.0,
+		(double)(ls->last_ns - ls->start_ns) / 1000000000.0);
+	fflush(fp);
+}
+
 int parse_rate(char *arg,char *rm_protocol, lbm_uint64_t *rm_rate, lbm_uint64_t *rm_retrans)
 {
 	char rate[50], retr_rate[50], mult[2];
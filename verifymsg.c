@@ -23,6 +23,31 @@
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_WIN32)
+	#include <windows.h>
+#endif
+#if defined(__linux__)
+	#include <sys/mman.h>
+#endif
+
+/*
+ * The SIMD checksum kernels are only built by x86 compilers that can target
+ * a single function at an instruction set, so the same binary still runs
+ * on CPUs without AVX2 or AVX-512.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+	#define CKSUM_SIMD 1
+	#define CKSUM_TARGET(isa) __attribute__((target(isa)))
+	#include <cpuid.h>
+	#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+	#define CKSUM_SIMD 1
+	#define CKSUM_TARGET(isa)
+	#include <intrin.h>
+	#include <immintrin.h>
+#else
+	#define CKSUM_SIMD 0
+#endif
 
 typedef struct {
 	char *iov_base;
@@ -35,59 +60,265 @@ typedef struct {
 #define VERIFIABLE_MAGIC_NUMBER_LEN 4
 #define MINIMUM_VERIFIABLE_MSG_LEN VERIFIABLE_MAGIC_NUMBER_LEN + sizeof(unsigned short int) + 2
 
+/*
+ * Version 2 header (32 bytes, integers little-endian), followed by random
+ * payload bytes:
+ *
+ *   0  version (2)              16  send timestamp, ns since the epoch
+ *   2  v2 magic number          24  payload length (bytes after the header)
+ *   6  header length (32)       28  CRC32C
+ *   8  application sequence number
+ *
+ * The CRC32C runs over the payload first and then header bytes 0-27, so a
+ * sender can checksum a payload once and stamp a new sequence number and
+ * timestamp on it for each send.  A v1 receiver sees a different magic
+ * number and reports the message as not verifiable instead of corrupt.
+ */
+#define VERIFIABLE_V2_MAGIC_NUMBER "\x1b\x33\x56\xdb"
+#define VERIFIABLE_V2_HDR_LEN 32
+#define V2_OFF_VERSION 0
+#define V2_OFF_MAGIC 2
+#define V2_OFF_HDR_LEN 6
+#define V2_OFF_SEQUENCE 8
+#define V2_OFF_TIMESTAMP 16
+#define V2_OFF_PAYLOAD_LEN 24
+#define V2_OFF_CRC 28
+
+/*
+ * Block layout (version 3): the v2 header with version 3 and its own magic
+ * number, followed by a table of CRC32Cs, one per 4 KB block of payload
+ * (the last block may be short), and then the payload:
+ *
+ *   0  v2 header fields; header length covers the table (32 + 4 * blocks)
+ *  28  summary CRC32C, over the block table and then header bytes 0-27
+ *  32  block CRC table, little-endian
+ *
+ * Each block can be checked on its own, so a failure can name the byte
+ * ranges that are damaged instead of just the message.
+ */
+#define VERIFIABLE_V3_MAGIC_NUMBER "\x1b\x33\x56\xdc"
+#define VERIFIABLE_V3_BLOCK_LEN 4096
+#define VERIFIABLE_V3_MAX_HDR_LEN 0xfffc
+
+static unsigned int crc32c_extend(unsigned int crc, const unsigned char *p, size_t len);
+
 #define FORCE_ALIGNED_ACCESS 0
 #if defined(sparc) || defined(__sparc) || defined(__sparc__) || defined(__ia64__)
 	#undef FORCE_ALIGNED_ACCESS
 	#define FORCE_ALIGNED_ACCESS 1
 #endif
 
-#if FORCE_ALIGNED_ACCESS
-size_t AlignmentBufferSize = 0;
-unsigned short int * AlignmentBuffer = NULL;
-#endif
-
 size_t
 minimum_verifiable_msglen(void)
 {
 	return (MINIMUM_VERIFIABLE_MSG_LEN);
 }
 
-static int rand_seeded = 0;
+size_t
+minimum_verifiable_msglen_v2(void)
+{
+	return (VERIFIABLE_V2_HDR_LEN);
+}
+
+/* Room for the header and one table entry */
+size_t
+minimum_verifiable_msglen_blocks(void)
+{
+	return (VERIFIABLE_V2_HDR_LEN + 4);
+}
+
+/*
+ * Payload generator: xoshiro256** (Blackman and Vigna), seeded through
+ * splitmix64.  Each step yields 8 random bytes, and fill loops take four
+ * steps (32 bytes) at a time, instead of calling rand() once per byte.
+ */
+typedef struct {
+	unsigned long long s[4];
+} prng_state_t;
+
+/*
+ * Verifier context: everything the construct and verify functions change.
+ * Each thread that builds or checks messages can own one and call the _r
+ * functions without locking; the plain functions share default_vctx.
+ */
+struct verifier_ctx_stct {
+	prng_state_t prng;			/* Payload generator */
+	int seeded;				/* prng has been seeded */
+	size_t scratch_len;			/* Bytes allocated for scratch */
+	unsigned short int *scratch;		/* Aligned copy of a message (FORCE_ALIGNED_ACCESS) */
+};
+
+static verifier_ctx_t default_vctx;
+
+static unsigned long long
+splitmix64(unsigned long long *x)
+{
+	unsigned long long z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (z ^ (z >> 31));
+}
+
+static void
+prng_seed(prng_state_t *st, unsigned long long seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		st->s[i] = splitmix64(&seed);
+}
+
+#define ROTL64(x, k) (((x) << (k)) | ((x) >> (64 - (k))))
+
+static unsigned long long
+prng_next(prng_state_t *st)
+{
+	unsigned long long *s = st->s;
+	unsigned long long result = ROTL64(s[1] * 5, 7) * 9;
+	unsigned long long t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = ROTL64(s[3], 45);
+	return (result);
+}
+
+static void
+prng_fill(prng_state_t *st, unsigned char *p, size_t len)
+{
+	unsigned long long r[4];
+
+	while (len >= sizeof(r)) {
+		r[0] = prng_next(st);
+		r[1] = prng_next(st);
+		r[2] = prng_next(st);
+		r[3] = prng_next(st);
+		memcpy(p, r, sizeof(r));
+		p += sizeof(r);
+		len -= sizeof(r);
+	}
+	while (len >= sizeof(r[0])) {
+		r[0] = prng_next(st);
+		memcpy(p, r, sizeof(r[0]));
+		p += sizeof(r[0]);
+		len -= sizeof(r[0]);
+	}
+	if (len > 0) {
+		r[0] = prng_next(st);
+		memcpy(p, r, len);
+	}
+}
+
+/* Seed a context's payload generator, making the message contents reproducible */
+void
+verifier_ctx_seed(verifier_ctx_t *vctx, unsigned long long seed)
+{
+	prng_seed(&vctx->prng, seed);
+	vctx->seeded = 1;
+}
+
+void
+verifiable_msg_seed(unsigned long long seed)
+{
+	verifier_ctx_seed(&default_vctx, seed);
+}
+
+static void
+prng_check_seeded(verifier_ctx_t *vctx)
+{
+	if (!vctx->seeded)
+	{
+		verifier_ctx_seed(vctx, (unsigned long long) time(NULL));
+	}
+}
+
+/*
+ * Create a verifier context.  Its generator is seeded from the time and the
+ * context's address, so contexts created together still produce different
+ * messages; use verifier_ctx_seed() for a reproducible sequence.
+ * Returns NULL if out of memory.
+ */
+verifier_ctx_t *
+verifier_ctx_create(void)
+{
+	verifier_ctx_t *vctx = (verifier_ctx_t *) malloc(sizeof(verifier_ctx_t));
+
+	if (vctx == NULL)
+		return (NULL);
+	memset(vctx, 0, sizeof(*vctx));
+	verifier_ctx_seed(vctx, ((unsigned long long) time(NULL) << 32) ^ (unsigned long long) (size_t) vctx);
+	return (vctx);
+}
+
+void
+verifier_ctx_delete(verifier_ctx_t *vctx)
+{
+	if (vctx == NULL)
+		return;
+	free(vctx->scratch);
+	free(vctx);
+}
+
+/*
+ * Measure the payload generator alone, filling msglen-sized buffers for
+ * roughly a quarter second of CPU time. Returns bytes per second (0 on
+ * allocation failure). Uses its own generator state, so it does not
+ * disturb a seeded sequence.
+ */
+double
+verifiable_msg_gen_rate(size_t msglen)
+{
+	prng_state_t st;
+	unsigned char *buf = NULL;
+	unsigned long long bytes = 0;
+	clock_t start, elapsed;
+
+	if (msglen == 0)
+		msglen = 1;
+	if ((buf = (unsigned char *) malloc(msglen)) == NULL)
+		return (0.0);
+	prng_seed(&st, 1);
+	start = clock();
+	do {
+		int i;
+
+		for (i = 0; i < 64; i++) {
+			prng_fill(&st, buf, msglen);
+			bytes += msglen;
+		}
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 4);
+	free(buf);
+	return ((double)bytes * CLOCKS_PER_SEC / (double)elapsed);
+}
 
 /* Create random content message with checksum */
 
 int
 construct_verifiable_msg(char * data, size_t len)
 {
-	unsigned char *datap = NULL;
+	return (construct_verifiable_msg_r(&default_vctx, data, len));
+}
+
+int
+construct_verifiable_msg_r(verifier_ctx_t *vctx, char * data, size_t len)
+{
 	unsigned short int * cksum = (unsigned short int *) data;
 	char * magicp = data + sizeof(unsigned short int);
 	size_t len_left = len - sizeof(unsigned short int) - VERIFIABLE_MAGIC_NUMBER_LEN;
+	size_t fill = (len_left > sizeof(unsigned short int)) ? len_left - sizeof(unsigned short int) : 0;
 
-	if (!rand_seeded)
-	{
-		srand(time(NULL));
-		rand_seeded = 1;
-	}
+	prng_check_seeded(vctx);
 
-	memset(data, 0, len);
+	/* checksum, magic number, random bytes, and (up to) two trailing zero bytes */
+	*cksum = 0;
 	memcpy(magicp, VERIFIABLE_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN);
-	datap = (unsigned char *)(data + VERIFIABLE_MAGIC_NUMBER_LEN + sizeof(unsigned short int));
-
-	while (len_left > sizeof(unsigned short int))
-	{
-#if defined(_WIN32)
-		/* Windows, by default, generates a number between 0 and 32,767 so we shouldn't be shifting */
-		*datap = (unsigned char) (rand() & 0xff);
-#else
-		/* According to `man 3 random`, "... the low dozen bits generated
-		   by rand go through a cyclic pattern." */
-			
-		*datap = (unsigned char) ((rand() >> 12) & 0xff);
-#endif
-		datap++;
-		len_left--;
-	}
+	prng_fill(&vctx->prng, (unsigned char *)(magicp + VERIFIABLE_MAGIC_NUMBER_LEN), fill);
+	memset(magicp + VERIFIABLE_MAGIC_NUMBER_LEN + fill, 0, len_left - fill);
 
 	*cksum = inet_cksum((unsigned short int *)data, len);
 	return 0;
@@ -96,92 +327,613 @@ construct_verifiable_msg(char * data, size_t len)
 int
 construct_verifiable_msgv(const lbm_iovec_t *iov, int count)
 {
-	unsigned char *datap = NULL;
+	return (construct_verifiable_msgv_r(&default_vctx, iov, count));
+}
+
+int
+construct_verifiable_msgv_r(verifier_ctx_t *vctx, const lbm_iovec_t *iov, int count)
+{
 	unsigned short int * cksum = (unsigned short int *) iov[0].iov_base;
 	char * magicp = iov[0].iov_base + sizeof(unsigned short int);
 	size_t len_left = iov[0].iov_len - sizeof(unsigned short int) - VERIFIABLE_MAGIC_NUMBER_LEN;
-	size_t total_len = 0;
 	int i = 0;
-	char *total_msg = NULL, *total_msgp = NULL;
 
-	if (!rand_seeded)
-	{
-		srand(time(NULL));
-		rand_seeded = 1;
+	prng_check_seeded(vctx);
+
+	*cksum = 0;
+	memcpy(magicp, VERIFIABLE_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN);
+	prng_fill(&vctx->prng, (unsigned char *)(magicp + VERIFIABLE_MAGIC_NUMBER_LEN), len_left - sizeof(unsigned short int));
+	memset(iov[0].iov_base + iov[0].iov_len - sizeof(unsigned short int), 0, sizeof(unsigned short int));
+	for (i = 1; i < count; i++) {
+		len_left = iov[i].iov_len;
+		if (len_left > sizeof(unsigned short int)) {
+			prng_fill(&vctx->prng, (unsigned char *)(iov[i].iov_base), len_left - sizeof(unsigned short int));
+			memset(iov[i].iov_base + len_left - sizeof(unsigned short int), 0, sizeof(unsigned short int));
+		} else {
+			memset(iov[i].iov_base, 0, len_left);
+		}
 	}
-	for (i = 0; i < count; i++) {
-		total_len += iov[i].iov_len;
+	/* Checksum the segments where they are; no gathered copy of the message */
+	*cksum = inet_cksumv(iov, count);
+	return 0;
+}
+
+static void
+put_le(unsigned char *p, unsigned long long val, int nbytes)
+{
+	while (nbytes-- > 0) {
+		*p++ = (unsigned char) val;
+		val >>= 8;
 	}
-	total_msg = malloc(total_len);
-	total_msgp = total_msg;
+}
 
-	memset(iov[0].iov_base, 0, iov[0].iov_len);
-	memcpy(magicp, VERIFIABLE_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN);
-	datap = (unsigned char *)(iov[0].iov_base + VERIFIABLE_MAGIC_NUMBER_LEN + sizeof(unsigned short int));
+static unsigned long long
+get_le(const unsigned char *p, int nbytes)
+{
+	unsigned long long val = 0;
 
-	while (len_left > sizeof(unsigned short int))
-	{
+	while (nbytes-- > 0)
+		val = (val << 8) | p[nbytes];
+	return (val);
+}
+
+/* Wall clock time in nanoseconds, for the v2 send timestamp */
+unsigned long long
+verifiable_msg_now_ns(void)
+{
 #if defined(_WIN32)
-		/* Windows, by default, generates a number between 0 and 32,767 so we shouldn't be shifting */
-		*datap = (unsigned char) (rand() & 0xff);
+	FILETIME ft;
+	unsigned long long t;
+
+	GetSystemTimePreciseAsFileTime(&ft);
+	t = ((unsigned long long) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	return ((t - 116444736000000000ULL) * 100);	/* 100ns ticks since 1601 */
 #else
-		/* According to `man 3 random`, "... the low dozen bits generated
-		   by rand go through a cyclic pattern." */
-		*datap = (unsigned char) ((rand() >> 12) & 0xff);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
 #endif
-		datap++;
-		len_left--;
-	}
-	memcpy(total_msgp, iov[0].iov_base, iov[0].iov_len);
-	total_msgp += iov[0].iov_len;
+}
+
+/* CRC32C state after the payload of a v2 message of len bytes */
+static unsigned int
+v2_payload_crc(const char *data, size_t len)
+{
+	return (crc32c_extend(0xffffffff, (const unsigned char *) data + VERIFIABLE_V2_HDR_LEN,
+		len - VERIFIABLE_V2_HDR_LEN));
+}
+
+/* Fill in the v2 header of a message whose payload is already in place */
+static void
+v2_stamp(char *data, size_t len, unsigned long long seq, unsigned int payload_crc)
+{
+	unsigned char *hdr = (unsigned char *) data;
+
+	put_le(hdr + V2_OFF_VERSION, 2, 2);
+	memcpy(hdr + V2_OFF_MAGIC, VERIFIABLE_V2_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN);
+	put_le(hdr + V2_OFF_HDR_LEN, VERIFIABLE_V2_HDR_LEN, 2);
+	put_le(hdr + V2_OFF_SEQUENCE, seq, 8);
+	put_le(hdr + V2_OFF_TIMESTAMP, verifiable_msg_now_ns(), 8);
+	put_le(hdr + V2_OFF_PAYLOAD_LEN, len - VERIFIABLE_V2_HDR_LEN, 4);
+	put_le(hdr + V2_OFF_CRC, ~crc32c_extend(payload_crc, hdr, V2_OFF_CRC), 4);
+}
+
+/* Create a v2 message: header with seq and the current time, random payload */
+int
+construct_verifiable_msg_v2(char * data, size_t len, unsigned long long seq)
+{
+	return (construct_verifiable_msg_v2_r(&default_vctx, data, len, seq));
+}
+
+int
+construct_verifiable_msg_v2_r(verifier_ctx_t *vctx, char * data, size_t len, unsigned long long seq)
+{
+	if (len < VERIFIABLE_V2_HDR_LEN)
+		return -1;
+	prng_check_seeded(vctx);
+	prng_fill(&vctx->prng, (unsigned char *)(data + VERIFIABLE_V2_HDR_LEN), len - VERIFIABLE_V2_HDR_LEN);
+	v2_stamp(data, len, seq, v2_payload_crc(data, len));
+	return 0;
+}
+
+/* Create a v2 message in segments; the header must fit in the first one */
+int
+construct_verifiable_msgv_v2(const lbm_iovec_t *iov, int count, unsigned long long seq)
+{
+	return (construct_verifiable_msgv_v2_r(&default_vctx, iov, count, seq));
+}
+
+int
+construct_verifiable_msgv_v2_r(verifier_ctx_t *vctx, const lbm_iovec_t *iov, int count, unsigned long long seq)
+{
+	size_t len;
+	unsigned int crc;
+	int i;
+
+	if (count < 1 || iov[0].iov_len < VERIFIABLE_V2_HDR_LEN)
+		return -1;
+	len = iov[0].iov_len;
+	prng_check_seeded(vctx);
+	prng_fill(&vctx->prng, (unsigned char *)(iov[0].iov_base + VERIFIABLE_V2_HDR_LEN), len - VERIFIABLE_V2_HDR_LEN);
+	crc = v2_payload_crc(iov[0].iov_base, len);
 	for (i = 1; i < count; i++) {
-		datap = (unsigned char *)(iov[i].iov_base);
-		len_left = iov[i].iov_len;
-		memset(iov[i].iov_base, 0, iov[i].iov_len);
-		while (len_left > sizeof(unsigned short int)) {
-#if defined(_WIN32)
-			/* Windows, by default, generates a number between 0 and 32,767 so we shouldn't be shifting */
-			*datap = (unsigned char) (rand() & 0xff);
-#else
-			/* According to `man 3 random`, "... the low dozen bits generated
-			   by rand go through a cyclic pattern." */
-			*datap = (unsigned short int) ((rand() >> 12) & 0xff);
+		prng_fill(&vctx->prng, (unsigned char *)(iov[i].iov_base), iov[i].iov_len);
+		crc = crc32c_extend(crc, (const unsigned char *)(iov[i].iov_base), iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	v2_stamp(iov[0].iov_base, len, seq, crc);
+	return 0;
+}
+
+/* Number of payload blocks in a block layout message of len bytes */
+static size_t
+v3_num_blocks(size_t len)
+{
+	/* every block costs 4 table bytes plus up to VERIFIABLE_V3_BLOCK_LEN of payload */
+	return ((len - VERIFIABLE_V2_HDR_LEN + VERIFIABLE_V3_BLOCK_LEN + 3) / (VERIFIABLE_V3_BLOCK_LEN + 4));
+}
+
+/* Fill in the header of a block layout message whose table is already in place */
+static void
+v3_stamp(char *data, size_t len, size_t hdr_len, unsigned long long seq)
+{
+	unsigned char *hdr = (unsigned char *) data;
+	unsigned int crc;
+
+	put_le(hdr + V2_OFF_VERSION, 3, 2);
+	memcpy(hdr + V2_OFF_MAGIC, VERIFIABLE_V3_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN);
+	put_le(hdr + V2_OFF_HDR_LEN, hdr_len, 2);
+	put_le(hdr + V2_OFF_SEQUENCE, seq, 8);
+	put_le(hdr + V2_OFF_TIMESTAMP, verifiable_msg_now_ns(), 8);
+	put_le(hdr + V2_OFF_PAYLOAD_LEN, len - hdr_len, 4);
+	crc = crc32c_extend(0xffffffff, hdr + VERIFIABLE_V2_HDR_LEN, hdr_len - VERIFIABLE_V2_HDR_LEN);
+	put_le(hdr + V2_OFF_CRC, ~crc32c_extend(crc, hdr, V2_OFF_CRC), 4);
+}
+
+/* Create a block layout message: v2-style header, block CRC table, random payload */
+int
+construct_verifiable_msg_blocks(char * data, size_t len, unsigned long long seq)
+{
+	return (construct_verifiable_msg_blocks_r(&default_vctx, data, len, seq));
+}
+
+int
+construct_verifiable_msg_blocks_r(verifier_ctx_t *vctx, char * data, size_t len, unsigned long long seq)
+{
+	size_t nblocks, hdr_len, payload_len, i, n;
+	const unsigned char *payload;
+
+	if (len < VERIFIABLE_V2_HDR_LEN + 4)
+		return -1;
+	nblocks = v3_num_blocks(len);
+	hdr_len = VERIFIABLE_V2_HDR_LEN + 4 * nblocks;
+	if (hdr_len > VERIFIABLE_V3_MAX_HDR_LEN)
+		return -1;
+	payload_len = len - hdr_len;
+	payload = (const unsigned char *) data + hdr_len;
+
+	prng_check_seeded(vctx);
+	prng_fill(&vctx->prng, (unsigned char *)(data + hdr_len), payload_len);
+	for (i = 0; i < nblocks; i++) {
+		/* the table can outgrow the payload by one (empty) block */
+		n = (i * VERIFIABLE_V3_BLOCK_LEN < payload_len) ? payload_len - i * VERIFIABLE_V3_BLOCK_LEN : 0;
+		if (n > VERIFIABLE_V3_BLOCK_LEN)
+			n = VERIFIABLE_V3_BLOCK_LEN;
+		put_le((unsigned char *) data + VERIFIABLE_V2_HDR_LEN + 4 * i,
+			~crc32c_extend(0xffffffff, payload + i * VERIFIABLE_V3_BLOCK_LEN, n), 4);
+	}
+	v3_stamp(data, len, hdr_len, seq);
+	return 0;
+}
+
+/*
+ * Payload ring.  All the messages a sender will cycle through are built and
+ * checksummed up front, so the send loop only has to pick the next slot.
+ * Slots are a cache line multiple apart in one arena, which can be backed
+ * by huge pages to keep TLB misses out of the loop as well.
+ */
+#define RING_SLOT_ALIGN 64
+#define RING_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+static char *
+ring_arena_alloc(size_t *len, int hugepages, int *hugepages_used)
+{
+	*hugepages_used = 0;
+#if defined(__linux__)
+	if (hugepages) {
+		size_t hlen = (*len + RING_HUGEPAGE_SIZE - 1) & ~((size_t) RING_HUGEPAGE_SIZE - 1);
+		void *p;
+
+#if defined(MAP_HUGETLB)
+		p = mmap(NULL, hlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			*len = hlen;
+			*hugepages_used = 2;
+			return ((char *) p);
+		}
 #endif
-			datap++;
-			len_left--;
+#if defined(MADV_HUGEPAGE)
+		/* No hugetlb pages reserved; ask for transparent huge pages instead */
+		p = mmap(NULL, hlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED) {
+			if (madvise(p, hlen, MADV_HUGEPAGE) == 0) {
+				*len = hlen;
+				*hugepages_used = 1;
+				return ((char *) p);
+			}
+			munmap(p, hlen);
+		}
+#endif
+	}
+#endif
+	return ((char *) malloc(*len));
+}
+
+/*
+ * Build a ring of nslots verifiable messages of the given version (1, 2,
+ * or 3 for the block layout).  Slot i holds a message of
+ * lens[i % nlens] bytes, so a list of lengths is spread evenly around the
+ * ring.  With hugepages set, the arena is backed by huge pages where the
+ * OS provides them (see ring->hugepages); otherwise it is plain malloc.
+ * Returns 0 on success, -1 on a bad length or allocation failure.
+ */
+int
+verifiable_ring_create(verifiable_ring_t *ring, unsigned int nslots, const size_t *lens, unsigned int nlens, int version, int hugepages)
+{
+	size_t minlen = (version == 3) ? VERIFIABLE_V2_HDR_LEN + 4 :
+		(version == 2) ? VERIFIABLE_V2_HDR_LEN : MINIMUM_VERIFIABLE_MSG_LEN;
+	size_t maxlen = 0;
+	unsigned int i;
+
+	memset(ring, 0, sizeof(*ring));
+	if (nslots == 0 || nlens == 0)
+		return (-1);
+	for (i = 0; i < nlens; i++) {
+		if (lens[i] < minlen)
+			return (-1);
+		if (lens[i] > maxlen)
+			maxlen = lens[i];
+	}
+	ring->stride = (maxlen + RING_SLOT_ALIGN - 1) & ~((size_t) RING_SLOT_ALIGN - 1);
+	ring->arena_len = ring->stride * nslots;
+	ring->lens = (size_t *) malloc(nslots * sizeof(size_t));
+	ring->crcs = (unsigned int *) malloc(nslots * sizeof(unsigned int));
+	if (ring->lens != NULL && ring->crcs != NULL)
+		ring->arena = ring_arena_alloc(&ring->arena_len, hugepages, &ring->hugepages);
+	if (ring->arena == NULL) {
+		free(ring->lens);
+		free(ring->crcs);
+		memset(ring, 0, sizeof(*ring));
+		return (-1);
+	}
+	ring->nslots = nslots;
+	ring->version = version;
+	for (i = 0; i < nslots; i++) {
+		char *slot = ring->arena + (size_t) i * ring->stride;
+
+		ring->lens[i] = lens[i % nlens];
+		if (version == 3) {
+			if (construct_verifiable_msg_blocks(slot, ring->lens[i], 0) != 0) {
+				verifiable_ring_delete(ring);
+				return (-1);
+			}
+		} else if (version == 2) {
+			construct_verifiable_msg_v2(slot, ring->lens[i], 0);
+			ring->crcs[i] = v2_payload_crc(slot, ring->lens[i]);
+		} else {
+			construct_verifiable_msg(slot, ring->lens[i]);
 		}
-		memcpy(total_msgp, iov[i].iov_base, iov[i].iov_len);
-		total_msgp += iov[i].iov_len;
 	}
-	*cksum = inet_cksum((unsigned short int *)total_msg, total_len);
-	free(total_msg);
 	return 0;
 }
 
+/*
+ * Next message in the ring; its length goes to *len when len is not NULL.
+ * A v2 message gets seq and the current time stamped into its header, which
+ * only re-checksums the header; the payload CRC was saved at build time.
+ * A block layout (v3) message is stamped the same way; its summary CRC
+ * covers the header and the block table, not the payload.
+ */
+const char *
+verifiable_ring_next(verifiable_ring_t *ring, size_t *len, unsigned long long seq)
+{
+	unsigned int slot = ring->next;
+	char *msg = ring->arena + (size_t) slot * ring->stride;
+
+	if (++ring->next == ring->nslots)
+		ring->next = 0;
+	if (ring->version == 3)
+		v3_stamp(msg, ring->lens[slot], VERIFIABLE_V2_HDR_LEN + 4 * v3_num_blocks(ring->lens[slot]), seq);
+	else if (ring->version == 2)
+		v2_stamp(msg, ring->lens[slot], seq, ring->crcs[slot]);
+	if (len != NULL)
+		*len = ring->lens[slot];
+	return (msg);
+}
+
+void
+verifiable_ring_delete(verifiable_ring_t *ring)
+{
+	if (ring->arena != NULL) {
+#if defined(__linux__)
+		if (ring->hugepages)
+			munmap(ring->arena, ring->arena_len);
+		else
+#endif
+			free(ring->arena);
+	}
+	free(ring->lens);
+	free(ring->crcs);
+	memset(ring, 0, sizeof(*ring));
+}
+
+/*
+ * Check a v2 header against a message of Length bytes whose payload has
+ * already been run through the CRC (payload_crc is the running register).
+ */
+static int
+verify_msg_v2_hdr(const unsigned char *hdr, size_t Length, unsigned int payload_crc, int Verbose, verifiable_msg_info_t *info)
+{
+	unsigned int calced_crc, msg_crc;
+
+	if (info != NULL) {
+		info->version = (int) get_le(hdr + V2_OFF_VERSION, 2);
+		info->sequence = get_le(hdr + V2_OFF_SEQUENCE, 8);
+		info->send_ns = get_le(hdr + V2_OFF_TIMESTAMP, 8);
+		info->payload_len = (size_t) get_le(hdr + V2_OFF_PAYLOAD_LEN, 4);
+	}
+	if (get_le(hdr + V2_OFF_VERSION, 2) != 2 || get_le(hdr + V2_OFF_HDR_LEN, 2) != VERIFIABLE_V2_HDR_LEN)
+	{
+		if (Verbose)
+			printf("Message has a bad v2 version or header length\n");
+		return (0);
+	}
+	if (get_le(hdr + V2_OFF_PAYLOAD_LEN, 4) != Length - VERIFIABLE_V2_HDR_LEN)
+	{
+		if (Verbose)
+			printf("Message payload length %lu does not match header (%lu)\n",
+				(unsigned long) (Length - VERIFIABLE_V2_HDR_LEN),
+				(unsigned long) get_le(hdr + V2_OFF_PAYLOAD_LEN, 4));
+		return (0);
+	}
+	calced_crc = ~crc32c_extend(payload_crc, hdr, V2_OFF_CRC);
+	msg_crc = (unsigned int) get_le(hdr + V2_OFF_CRC, 4);
+	if (Verbose)
+	{
+		printf("Message calculated crc32c 0x%x, header 0x%x\n", calced_crc, msg_crc);
+	}
+	return ((calced_crc == msg_crc) ? 1 : 0);
+}
+
+static int
+verify_msg_v2(const char * Data, size_t Length, int Verbose, verifiable_msg_info_t *info)
+{
+	return (verify_msg_v2_hdr((const unsigned char *) Data, Length, v2_payload_crc(Data, Length), Verbose, info));
+}
+
+/*
+ * Check a block layout message.  Fills in ranges (up to max_ranges) with
+ * the damaged byte ranges of the message, merging neighboring blocks, and
+ * returns how many there are: 0 if the message is intact, or -1 if its
+ * header is too damaged to find the blocks.
+ */
+static int
+v3_check(const char * Data, size_t Length, verifiable_bad_range_t *ranges, int max_ranges)
+{
+	const unsigned char *hdr = (const unsigned char *) Data;
+	size_t hdr_len, payload_len, nblocks, i, n, start, end;
+	int nranges = 0, open = 0;
+	unsigned int crc;
+
+	if (Length < VERIFIABLE_V2_HDR_LEN || get_le(hdr + V2_OFF_VERSION, 2) != 3)
+		return (-1);
+	hdr_len = (size_t) get_le(hdr + V2_OFF_HDR_LEN, 2);
+	payload_len = (size_t) get_le(hdr + V2_OFF_PAYLOAD_LEN, 4);
+	if (hdr_len < VERIFIABLE_V2_HDR_LEN || hdr_len > Length || payload_len != Length - hdr_len)
+		return (-1);
+	nblocks = (hdr_len - VERIFIABLE_V2_HDR_LEN) / 4;
+	if (nblocks * VERIFIABLE_V3_BLOCK_LEN < payload_len)
+		return (-1);
+
+	/* the header and table come first in the message, and in the report */
+	crc = crc32c_extend(0xffffffff, hdr + VERIFIABLE_V2_HDR_LEN, hdr_len - VERIFIABLE_V2_HDR_LEN);
+	if (~crc32c_extend(crc, hdr, V2_OFF_CRC) != (unsigned int) get_le(hdr + V2_OFF_CRC, 4)) {
+		if (max_ranges > 0) {
+			ranges[0].offset = 0;
+			ranges[0].len = hdr_len;
+		}
+		nranges = 1;
+		open = 1;
+	}
+	for (i = 0; i < nblocks; i++) {
+		start = i * VERIFIABLE_V3_BLOCK_LEN;
+		n = (start < payload_len) ? payload_len - start : 0;
+		if (n > VERIFIABLE_V3_BLOCK_LEN)
+			n = VERIFIABLE_V3_BLOCK_LEN;
+		crc = ~crc32c_extend(0xffffffff, hdr + hdr_len + start, n);
+		if (crc == (unsigned int) get_le(hdr + VERIFIABLE_V2_HDR_LEN + 4 * i, 4)) {
+			open = 0;
+			continue;
+		}
+		start += hdr_len;
+		end = start + n;
+		if (open) {
+			if (nranges <= max_ranges)
+				ranges[nranges - 1].len = end - ranges[nranges - 1].offset;
+			continue;
+		}
+		if (nranges < max_ranges) {
+			ranges[nranges].offset = start;
+			ranges[nranges].len = end - start;
+		}
+		nranges++;
+		open = 1;
+	}
+	return (nranges);
+}
+
+static int
+verify_msg_v3(const char * Data, size_t Length, int Verbose, verifiable_msg_info_t *info)
+{
+	const unsigned char *hdr = (const unsigned char *) Data;
+	int nranges;
+
+	if (info != NULL) {
+		info->version = 3;
+		info->sequence = get_le(hdr + V2_OFF_SEQUENCE, 8);
+		info->send_ns = get_le(hdr + V2_OFF_TIMESTAMP, 8);
+		info->payload_len = (size_t) get_le(hdr + V2_OFF_PAYLOAD_LEN, 4);
+	}
+	nranges = v3_check(Data, Length, NULL, 0);
+	if (Verbose) {
+		if (nranges < 0)
+			printf("Message has a bad block layout header\n");
+		else
+			printf("Message has %d damaged byte range%s\n", nranges, (nranges == 1) ? "" : "s");
+	}
+	return ((nranges == 0) ? 1 : 0);
+}
+
+/*
+ * For a block layout message, find the damaged byte ranges (see
+ * v3_check()).  Returns -1 for any other kind of message.
+ */
+int
+verify_msg_blocks(const char * Data, size_t Length, verifiable_bad_range_t *ranges, int max_ranges)
+{
+	if (Length < VERIFIABLE_V2_HDR_LEN
+		|| memcmp(Data + V2_OFF_MAGIC, VERIFIABLE_V3_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) != 0)
+	{
+		return (-1);
+	}
+	return (v3_check(Data, Length, ranges, max_ranges));
+}
+
+/* After a failed verify, print which byte ranges of a block layout message are damaged */
+void
+print_verify_bad_ranges(FILE *fp, const char * Data, size_t Length)
+{
+	verifiable_bad_range_t ranges[8];
+	int nranges, i;
+
+	nranges = verify_msg_blocks(Data, Length, ranges, 8);
+	if (nranges < 0) {
+		if (Length >= VERIFIABLE_V2_HDR_LEN
+			&& memcmp(Data + V2_OFF_MAGIC, VERIFIABLE_V3_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0)
+			fprintf(fp, "  block layout header is damaged; blocks cannot be located\n");
+		return;
+	}
+	fprintf(fp, "  damaged bytes:");
+	for (i = 0; i < nranges && i < 8; i++)
+		fprintf(fp, " %lu-%lu", (unsigned long) ranges[i].offset,
+			(unsigned long) (ranges[i].offset + ranges[i].len - 1));
+	if (nranges > 8)
+		fprintf(fp, " (and %d more ranges)", nranges - 8);
+	fprintf(fp, " of %lu\n", (unsigned long) Length);
+}
+
+/*
+ * Read the header of a verifiable message without checking its contents,
+ * filling in info when it is not NULL. Returns the version (1, 2, or 3 for
+ * the block layout), or -1
+ * if the message is not a verifiable message.
+ */
+int
+verify_msg_header(const char * Data, size_t Length, verifiable_msg_info_t *info)
+{
+	const unsigned char *hdr = (const unsigned char *) Data;
+
+	if (Length >= VERIFIABLE_V2_HDR_LEN
+		&& memcmp(Data + V2_OFF_MAGIC, VERIFIABLE_V2_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0)
+	{
+		if (info != NULL) {
+			info->version = 2;
+			info->sequence = get_le(hdr + V2_OFF_SEQUENCE, 8);
+			info->send_ns = get_le(hdr + V2_OFF_TIMESTAMP, 8);
+			info->payload_len = (size_t) get_le(hdr + V2_OFF_PAYLOAD_LEN, 4);
+		}
+		return (2);
+	}
+	if (Length >= VERIFIABLE_V2_HDR_LEN
+		&& memcmp(Data + V2_OFF_MAGIC, VERIFIABLE_V3_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0)
+	{
+		if (info != NULL) {
+			info->version = 3;
+			info->sequence = get_le(hdr + V2_OFF_SEQUENCE, 8);
+			info->send_ns = get_le(hdr + V2_OFF_TIMESTAMP, 8);
+			info->payload_len = (size_t) get_le(hdr + V2_OFF_PAYLOAD_LEN, 4);
+		}
+		return (3);
+	}
+	if (Length < MINIMUM_VERIFIABLE_MSG_LEN
+		|| memcmp(Data + sizeof(unsigned short int), VERIFIABLE_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) != 0)
+	{
+		return (-1);
+	}
+	if (info != NULL) {
+		memset(info, 0, sizeof(*info));
+		info->version = 1;
+		info->payload_len = Length;
+	}
+	return (1);
+}
+
 /* Utility to check previously checksum'd buffer. Returns 1 if correct,
    0 if incorrect, and -1 if the message is not a verifiable message. */
 int
 verify_msg(const char * Data, size_t Length, int Verbose)
+{
+	return (verify_msg_info(Data, Length, Verbose, NULL));
+}
+
+/* verify_msg() for v1 or v2 messages, also returning what the header holds */
+int
+verify_msg_info(const char * Data, size_t Length, int Verbose, verifiable_msg_info_t *info)
+{
+	return (verify_msg_r(&default_vctx, Data, Length, Verbose, info));
+}
+
+/* verify_msg_info() using only the state in vctx; info may be NULL */
+int
+verify_msg_r(verifier_ctx_t *vctx, const char * Data, size_t Length, int Verbose, verifiable_msg_info_t *info)
 {
 	unsigned short int calced_cksum = 0;
 	unsigned short int * dataptr = NULL;
 
+	if (Length >= VERIFIABLE_V2_HDR_LEN
+		&& memcmp(Data + V2_OFF_MAGIC, VERIFIABLE_V2_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0)
+	{
+		return (verify_msg_v2(Data, Length, Verbose, info));
+	}
+	if (Length >= VERIFIABLE_V2_HDR_LEN
+		&& memcmp(Data + V2_OFF_MAGIC, VERIFIABLE_V3_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0)
+	{
+		return (verify_msg_v3(Data, Length, Verbose, info));
+	}
+	if (info != NULL)
+	{
+		memset(info, 0, sizeof(*info));
+		info->version = 1;
+		info->payload_len = Length;
+	}
 	if (Length < MINIMUM_VERIFIABLE_MSG_LEN)
 	{
 		return (-1);
 	}
 #if FORCE_ALIGNED_ACCESS
-	if (AlignmentBufferSize < Length)
+	if (vctx->scratch_len < Length)
 	{
-		AlignmentBufferSize = Length;
-		if (AlignmentBuffer != NULL)
+		free((void *) vctx->scratch);
+		vctx->scratch = (unsigned short *) malloc(Length);
+		vctx->scratch_len = (vctx->scratch != NULL) ? Length : 0;
+		if (vctx->scratch == NULL)
 		{
-			free((void *) AlignmentBuffer);
+			return (-1);
 		}
-		AlignmentBuffer = (unsigned short *) malloc(AlignmentBufferSize);
 	}
-	memcpy((void *) AlignmentBuffer, Data, Length);
-	dataptr = AlignmentBuffer;
+	memcpy((void *) vctx->scratch, Data, Length);
+	dataptr = vctx->scratch;
 #else
 	dataptr = (unsigned short *) Data;
 #endif
@@ -225,11 +977,11 @@ verify_msg(const char * Data, size_t Length, int Verbose)
  *
  */
 
-unsigned short int
-inet_cksum(unsigned short int *addr, size_t len)
+static unsigned long long
+cksum_partial_scalar(const unsigned short int *addr, size_t len)
 {
 	register int nleft = (int)len;
-	register unsigned short int *w = addr;
+	register const unsigned short int *w = addr;
 	unsigned short int answer = 0;
 	register unsigned int sum = 0;
 
@@ -248,16 +1000,648 @@ inet_cksum(unsigned short int *addr, size_t len)
 
 	/* mop up an odd byte, if necessary */
 	if( nleft == 1 ) {
-		*(unsigned char *) (&answer) = *(unsigned char *)w ;
+		*(unsigned char *) (&answer) = *(const unsigned char *)w ;
 		sum += answer;
 	}
+	return (sum);
+}
 
-	/*
-	 * add back carry outs from top 16 bits to low 16 bits
-	 */
+/*
+ * SIMD kernels.  Each one zero-extends the 16 bit words into 32 bit lanes
+ * and adds them up, flushing the lanes into a 64 bit total before they can
+ * overflow (two words per lane per vector, so at most 32767 vectors).
+ * A ones' complement sum does not depend on the order the words are added
+ * in, so after the final fold the result is bit-identical to the scalar
+ * loop.  Whatever is left after the last full vector goes to the next
+ * narrower kernel.
+ */
+#if CKSUM_SIMD
+#define CKSUM_SIMD_MAX_VECTORS 32767
+
+static CKSUM_TARGET("sse2") unsigned long long
+cksum_partial_sse2(const unsigned short int *addr, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)addr;
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long long sum = 0;
+	unsigned int lanes[4];
+	int i;
+
+	while (len >= 16) {
+		size_t nvec = len / 16;
+		__m128i acc = zero;
+
+		if (nvec > CKSUM_SIMD_MAX_VECTORS)
+			nvec = CKSUM_SIMD_MAX_VECTORS;
+		len -= nvec * 16;
+		while (nvec-- > 0) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+			p += 16;
+		}
+		_mm_storeu_si128((__m128i *)lanes, acc);
+		for (i = 0; i < 4; i++)
+			sum += lanes[i];
+	}
+	return (sum + cksum_partial_scalar((const unsigned short int *)p, len));
+}
+
+static CKSUM_TARGET("avx2") unsigned long long
+cksum_partial_avx2(const unsigned short int *addr, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)addr;
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned long long sum = 0;
+	unsigned int lanes[8];
+	int i;
+
+	while (len >= 32) {
+		size_t nvec = len / 32;
+		__m256i acc = zero;
+
+		if (nvec > CKSUM_SIMD_MAX_VECTORS)
+			nvec = CKSUM_SIMD_MAX_VECTORS;
+		len -= nvec * 32;
+		while (nvec-- > 0) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)p);
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+			p += 32;
+		}
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		for (i = 0; i < 8; i++)
+			sum += lanes[i];
+	}
+	return (sum + cksum_partial_sse2((const unsigned short int *)p, len));
+}
+
+static CKSUM_TARGET("avx512f,avx512bw") unsigned long long
+cksum_partial_avx512(const unsigned short int *addr, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)addr;
+	const __m512i zero = _mm512_setzero_si512();
+	unsigned long long sum = 0;
+	unsigned int lanes[16];
+	int i;
+
+	while (len >= 64) {
+		size_t nvec = len / 64;
+		__m512i acc = zero;
+
+		if (nvec > CKSUM_SIMD_MAX_VECTORS)
+			nvec = CKSUM_SIMD_MAX_VECTORS;
+		len -= nvec * 64;
+		while (nvec-- > 0) {
+			__m512i v = _mm512_loadu_si512((const void *)p);
+			acc = _mm512_add_epi32(acc, _mm512_unpacklo_epi16(v, zero));
+			acc = _mm512_add_epi32(acc, _mm512_unpackhi_epi16(v, zero));
+			p += 64;
+		}
+		_mm512_storeu_si512((void *)lanes, acc);
+		for (i = 0; i < 16; i++)
+			sum += lanes[i];
+	}
+	return (sum + cksum_partial_avx2((const unsigned short int *)p, len));
+}
+
+#define CPU_HAS_SSE2   0x1
+#define CPU_HAS_AVX2   0x2
+#define CPU_HAS_AVX512 0x4
+#define CPU_HAS_SSE42  0x8
+
+/* Ask CPUID (and XGETBV, for the register state the OS saves) what we can use */
+static int
+cksum_cpu_features(void)
+{
+	unsigned int regs[4] = { 0, 0, 0, 0 };	/* eax, ebx, ecx, edx */
+	unsigned int max_leaf = 0;
+	unsigned long long xcr0 = 0;
+	int features = 0;
+
+#if defined(_MSC_VER)
+	__cpuid((int *)regs, 0);
+	max_leaf = regs[0];
+	__cpuid((int *)regs, 1);
+#else
+	max_leaf = __get_cpuid_max(0, NULL);
+	if (max_leaf < 1)
+		return (0);
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	if (regs[3] & (1u << 26))
+		features |= CPU_HAS_SSE2;
+	if (regs[2] & (1u << 20))
+		features |= CPU_HAS_SSE42;
+	if (!(regs[2] & (1u << 27)))	/* no OSXSAVE, no AVX state */
+		return (features);
+#if defined(_MSC_VER)
+	xcr0 = _xgetbv(0);
+#else
+	{
+		unsigned int lo, hi;
+		__asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((unsigned long long)hi << 32) | lo;
+	}
+#endif
+	if (max_leaf < 7)
+		return (features);
+#if defined(_MSC_VER)
+	__cpuidex((int *)regs, 7, 0);
+#else
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	if ((xcr0 & 0x6) == 0x6 && (regs[1] & (1u << 5)))
+		features |= CPU_HAS_AVX2;
+	if ((xcr0 & 0xe6) == 0xe6 && (regs[1] & (1u << 16)) && (regs[1] & (1u << 30)))
+		features |= CPU_HAS_AVX512;
+	return (features);
+}
+#endif /* CKSUM_SIMD */
+
+typedef unsigned long long (*cksum_partial_func_t)(const unsigned short int *, size_t);
+
+static unsigned long long cksum_partial_select(const unsigned short int *addr, size_t len);
+
+static cksum_partial_func_t cksum_partial = cksum_partial_select;
+static const char *cksum_kernel_name = NULL;
+
+/*
+ * Pick the widest kernel the CPU supports.  This runs once, on the first
+ * checksum; threads racing through here all arrive at the same answer.
+ */
+static void
+cksum_select_kernel(void)
+{
+	cksum_partial_func_t func = cksum_partial_scalar;
+	const char *name = "scalar";
+#if CKSUM_SIMD
+	int features = cksum_cpu_features();
+
+	if (features & CPU_HAS_AVX512) {
+		func = cksum_partial_avx512;
+		name = "avx512";
+	} else if (features & CPU_HAS_AVX2) {
+		func = cksum_partial_avx2;
+		name = "avx2";
+	} else if (features & CPU_HAS_SSE2) {
+		func = cksum_partial_sse2;
+		name = "sse2";
+	}
+#endif
+	cksum_kernel_name = name;
+	cksum_partial = func;
+}
+
+static unsigned long long
+cksum_partial_select(const unsigned short int *addr, size_t len)
+{
+	cksum_select_kernel();
+	return (cksum_partial(addr, len));
+}
+
+/* Name of the checksum kernel in use: "scalar", "sse2", "avx2" or "avx512" */
+const char *
+inet_cksum_kernel(void)
+{
+	if (cksum_kernel_name == NULL)
+		cksum_select_kernel();
+	return (cksum_kernel_name);
+}
+
+/*
+ * Use the named checksum kernel from now on, instead of the one picked
+ * automatically (for benchmarks and testing).  Returns -1, changing
+ * nothing, if the name is unknown or the CPU cannot run that kernel.
+ */
+int
+inet_cksum_set_kernel(const char *name)
+{
+	cksum_partial_func_t func = NULL;
+	const char *kname = NULL;
+#if CKSUM_SIMD
+	int features = cksum_cpu_features();
+
+	if (strcmp(name, "sse2") == 0 && (features & CPU_HAS_SSE2)) {
+		func = cksum_partial_sse2;
+		kname = "sse2";
+	} else if (strcmp(name, "avx2") == 0 && (features & CPU_HAS_AVX2)) {
+		func = cksum_partial_avx2;
+		kname = "avx2";
+	} else if (strcmp(name, "avx512") == 0 && (features & CPU_HAS_AVX512)) {
+		func = cksum_partial_avx512;
+		kname = "avx512";
+	}
+#endif
+	if (strcmp(name, "scalar") == 0) {
+		func = cksum_partial_scalar;
+		kname = "scalar";
+	}
+	if (func == NULL)
+		return (-1);
+	cksum_kernel_name = kname;
+	cksum_partial = func;
+	return (0);
+}
+
+/* add back carry outs from top 16 bits to low 16 bits */
+static unsigned int
+cksum_fold(unsigned long long sum)
+{
 	while (sum >> 16)
 		sum = (sum >> 16) + (sum & 0xffff);  /* add hi 16 to low 16 */
-	answer = ~sum;				     /* truncate to 16 bits */
-	return (answer);
+	return ((unsigned int) sum);
 }
 
+unsigned short int
+inet_cksum(unsigned short int *addr, size_t len)
+{
+	return ((unsigned short int) ~cksum_fold(cksum_partial(addr, len)));	/* truncate to 16 bits */
+}
+
+#if FORCE_ALIGNED_ACCESS
+/* Word-at-a-time sum for segments that do not start on a 16 bit boundary */
+static unsigned long long
+cksum_partial_unaligned(const unsigned char *p, size_t len)
+{
+	unsigned long long sum = 0;
+	unsigned short int w;
+
+	while (len > 1) {
+		memcpy(&w, p, sizeof(w));
+		sum += w;
+		p += 2;
+		len -= 2;
+	}
+	if (len == 1) {
+		w = 0;
+		*(unsigned char *) (&w) = *p;
+		sum += w;
+	}
+	return (sum);
+}
+#endif
+
+/*
+ * Add one segment of a message that starts offset bytes into the message
+ * to a running (unfolded) sum.  A segment at an odd offset pairs its bytes
+ * with the opposite halves of the 16 bit words, and in ones' complement
+ * arithmetic that is the same as byte-swapping the segment's own sum
+ * (RFC 1071, section 2(B)).  Odd-length segments therefore need no copy
+ * or carry byte.
+ */
+static unsigned long long
+cksum_stream_add(unsigned long long sum, size_t offset, const char *data, size_t len)
+{
+	unsigned int part;
+
+#if FORCE_ALIGNED_ACCESS
+	if (((size_t) data) & 1)
+		part = cksum_fold(cksum_partial_unaligned((const unsigned char *) data, len));
+	else
+#endif
+	part = cksum_fold(cksum_partial((const unsigned short int *) data, len));
+	if (offset & 1)
+		part = ((part & 0xff) << 8) | (part >> 8);
+	return (sum + part);
+}
+
+/* inet_cksum() of the concatenation of count segments, computed in place */
+unsigned short int
+inet_cksumv(const lbm_iovec_t *iov, int count)
+{
+	unsigned long long sum = 0;
+	size_t offset = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		sum = cksum_stream_add(sum, offset, iov[i].iov_base, iov[i].iov_len);
+		offset += iov[i].iov_len;
+	}
+	return ((unsigned short int) ~cksum_fold(sum));
+}
+
+/*
+ * Incremental verification, for a message that arrives in pieces (e.g. TCP
+ * recv() chunks).  Each piece is checksummed where it lies; only the first
+ * VERIFY_STREAM_HDR_LEN bytes are copied, so the header can be read once it
+ * is complete.  A v2 or v3 header carries the message length, so
+ * verify_stream_update() stops at the end of such a message and returns how
+ * much of the piece it used; the rest belongs to the next message.  A v1
+ * message has no length, so it runs until verify_stream_final().
+ *
+ * A v3 block table is not kept.  The table is run through one CRC and the
+ * CRCs of the blocks, as each one ends, through another; the two only agree
+ * if every block matches its table entry.
+ */
+void
+verify_stream_init(verify_stream_t *vs)
+{
+	memset(vs, 0, sizeof(*vs));
+	vs->crc = 0xffffffff;
+	vs->blk_crc = 0xffffffff;
+	vs->blks_crc = 0xffffffff;
+}
+
+/* Close the current v3 block: add its CRC, as the table holds it, to blks_crc */
+static void
+v3_stream_end_block(verify_stream_t *vs)
+{
+	unsigned char le[4];
+
+	put_le(le, ~vs->blk_crc, 4);
+	vs->blks_crc = crc32c_extend(vs->blks_crc, le, 4);
+	vs->blk_crc = 0xffffffff;
+}
+
+/* Add n payload bytes of a v3 message, ending blocks at their boundaries */
+static void
+v3_stream_add(verify_stream_t *vs, const unsigned char *data, size_t n)
+{
+	size_t pos = vs->offset - vs->hdr_len, m;
+
+	while (n > 0) {
+		m = VERIFIABLE_V3_BLOCK_LEN - pos % VERIFIABLE_V3_BLOCK_LEN;
+		if (m > n)
+			m = n;
+		vs->blk_crc = crc32c_extend(vs->blk_crc, data, m);
+		data += m;
+		n -= m;
+		pos += m;
+		if (pos % VERIFIABLE_V3_BLOCK_LEN == 0)
+			v3_stream_end_block(vs);
+	}
+}
+
+size_t
+verify_stream_update(verify_stream_t *vs, const char *data, size_t len)
+{
+	size_t used = 0;
+	size_t n, m;
+
+	/* Hold the first bytes until the magic number says which version this is */
+	if (vs->offset < VERIFY_STREAM_HDR_LEN && (vs->version == 0 || vs->version == 2 || vs->version == 3)) {
+		n = VERIFY_STREAM_HDR_LEN - vs->offset;
+		if (n > len)
+			n = len;
+		memcpy(vs->hdr + vs->offset, data, n);
+		vs->offset += n;
+		used = n;
+		if (vs->version == 0 && vs->offset >= V2_OFF_MAGIC + VERIFIABLE_MAGIC_NUMBER_LEN) {
+			if (memcmp(vs->hdr + V2_OFF_MAGIC, VERIFIABLE_V2_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0) {
+				vs->version = 2;
+			} else if (memcmp(vs->hdr + V2_OFF_MAGIC, VERIFIABLE_V3_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0) {
+				vs->version = 3;
+			} else if (memcmp(vs->hdr + sizeof(unsigned short int), VERIFIABLE_MAGIC_NUMBER, VERIFIABLE_MAGIC_NUMBER_LEN) == 0) {
+				vs->version = 1;
+				vs->sum = cksum_stream_add(0, 0, (const char *) vs->hdr, vs->offset);
+			} else {
+				vs->version = -1;
+			}
+		}
+		if (vs->version == 2 && vs->offset == VERIFIABLE_V2_HDR_LEN)
+			vs->msg_len = VERIFIABLE_V2_HDR_LEN + (size_t) get_le(vs->hdr + V2_OFF_PAYLOAD_LEN, 4);
+		if (vs->version == 3 && vs->offset == VERIFIABLE_V2_HDR_LEN) {
+			vs->hdr_len = (size_t) get_le(vs->hdr + V2_OFF_HDR_LEN, 2);
+			/* without a sane table length there is no finding the next message */
+			if (vs->hdr_len < VERIFIABLE_V2_HDR_LEN + 4 || (vs->hdr_len - VERIFIABLE_V2_HDR_LEN) % 4 != 0)
+				vs->version = -1;
+			else
+				vs->msg_len = vs->hdr_len + (size_t) get_le(vs->hdr + V2_OFF_PAYLOAD_LEN, 4);
+		}
+	}
+	if (used == len)
+		return (used);
+
+	n = len - used;
+	if (vs->version == 1) {
+		vs->sum = cksum_stream_add(vs->sum, vs->offset, data + used, n);
+	} else if (vs->version == 2) {
+		if (n > vs->msg_len - vs->offset)
+			n = vs->msg_len - vs->offset;
+		vs->crc = crc32c_extend(vs->crc, (const unsigned char *) data + used, n);
+	} else if (vs->version == 3) {
+		if (n > vs->msg_len - vs->offset)
+			n = vs->msg_len - vs->offset;
+		m = 0;
+		if (vs->offset < vs->hdr_len) {
+			m = vs->hdr_len - vs->offset;
+			if (m > n)
+				m = n;
+			vs->crc = crc32c_extend(vs->crc, (const unsigned char *) data + used, m);
+			vs->offset += m;
+		}
+		v3_stream_add(vs, (const unsigned char *) data + used + m, n - m);
+		vs->offset += n - m;
+		return (used + n);
+	}
+	vs->offset += n;
+	return (used + n);
+}
+
+/* 1 once every byte of a v2 or v3 message has been added; 0 otherwise */
+int
+verify_stream_complete(const verify_stream_t *vs)
+{
+	return (((vs->version == 2 || vs->version == 3) && vs->msg_len != 0 && vs->offset == vs->msg_len) ? 1 : 0);
+}
+
+/* The v3 half of verify_stream_final() */
+static int
+verify_stream_final_v3(verify_stream_t *vs, int Verbose, verifiable_msg_info_t *info)
+{
+	size_t nblocks, payload_len, done;
+	unsigned int calced_crc, msg_crc;
+
+	if (info != NULL) {
+		info->version = 3;
+		info->sequence = get_le(vs->hdr + V2_OFF_SEQUENCE, 8);
+		info->send_ns = get_le(vs->hdr + V2_OFF_TIMESTAMP, 8);
+		info->payload_len = (size_t) get_le(vs->hdr + V2_OFF_PAYLOAD_LEN, 4);
+	}
+	if (vs->offset < vs->hdr_len) {
+		if (Verbose)
+			printf("Message ended inside its v3 block table (%lu bytes)\n", (unsigned long) vs->offset);
+		return (0);
+	}
+	nblocks = (vs->hdr_len - VERIFIABLE_V2_HDR_LEN) / 4;
+	payload_len = vs->offset - vs->hdr_len;
+	if (get_le(vs->hdr + V2_OFF_PAYLOAD_LEN, 4) != payload_len || nblocks * VERIFIABLE_V3_BLOCK_LEN < payload_len) {
+		if (Verbose)
+			printf("Message payload length %lu does not match its v3 header\n", (unsigned long) payload_len);
+		return (0);
+	}
+	/* finish the last partial block, then any empty ones the table still lists */
+	done = payload_len / VERIFIABLE_V3_BLOCK_LEN;
+	if (payload_len % VERIFIABLE_V3_BLOCK_LEN != 0) {
+		v3_stream_end_block(vs);
+		done++;
+	}
+	for (; done < nblocks; done++)
+		v3_stream_end_block(vs);
+	if (vs->blks_crc != vs->crc) {
+		if (Verbose)
+			printf("Message has damaged v3 blocks\n");
+		return (0);
+	}
+	calced_crc = ~crc32c_extend(vs->crc, vs->hdr, V2_OFF_CRC);
+	msg_crc = (unsigned int) get_le(vs->hdr + V2_OFF_CRC, 4);
+	if (Verbose)
+		printf("Message calculated crc32c 0x%x, header 0x%x\n", calced_crc, msg_crc);
+	return ((calced_crc == msg_crc) ? 1 : 0);
+}
+
+/* verify_msg_info() of everything added since verify_stream_init() */
+int
+verify_stream_final(verify_stream_t *vs, int Verbose, verifiable_msg_info_t *info)
+{
+	if (vs->version == 3 && vs->offset >= VERIFIABLE_V2_HDR_LEN)
+		return (verify_stream_final_v3(vs, Verbose, info));
+	if (vs->version == 2 || vs->version == 3) {
+		if (vs->offset < VERIFIABLE_V2_HDR_LEN) {
+			if (Verbose)
+				printf("Message ended inside its v%d header (%lu bytes)\n", vs->version, (unsigned long) vs->offset);
+			return (0);
+		}
+		return (verify_msg_v2_hdr(vs->hdr, vs->offset, vs->crc, Verbose, info));
+	}
+	if (info != NULL) {
+		memset(info, 0, sizeof(*info));
+		info->version = 1;
+		info->payload_len = vs->offset;
+	}
+	if (vs->version != 1 || vs->offset < MINIMUM_VERIFIABLE_MSG_LEN)
+		return (-1);
+	if (Verbose)
+		printf("Message calculated cksum 0x%x\n", (unsigned int) (unsigned short int) ~cksum_fold(vs->sum));
+	return (((unsigned short int) ~cksum_fold(vs->sum) == 0) ? 1 : 0);
+}
+
+/*
+ * CRC32C (Castagnoli), as used by the v2 header.  The SSE4.2 crc32
+ * instruction does eight bytes at a time; elsewhere a byte-wise table
+ * lookup gives the same result.  Callers pass and get back the running
+ * (uninverted) CRC register, so a message can be covered in pieces.
+ */
+#define CRC32C_POLY 0x82f63b78	/* reflected */
+
+typedef unsigned int (*crc32c_func_t)(unsigned int, const unsigned char *, size_t);
+
+static unsigned int crc32c_table[256];
+
+static unsigned int
+crc32c_sw(unsigned int crc, const unsigned char *p, size_t len)
+{
+	while (len-- > 0)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return (crc);
+}
+
+#if CKSUM_SIMD
+static CKSUM_TARGET("sse4.2") unsigned int
+crc32c_sse42(unsigned int crc, const unsigned char *p, size_t len)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	unsigned long long crc64 = crc;
+
+	while (len >= 8) {
+		unsigned long long v;
+
+		memcpy(&v, p, sizeof(v));
+		crc64 = _mm_crc32_u64(crc64, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = (unsigned int) crc64;
+#endif
+	while (len >= 4) {
+		unsigned int v;
+
+		memcpy(&v, p, sizeof(v));
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		len -= 4;
+	}
+	while (len-- > 0)
+		crc = _mm_crc32_u8(crc, *p++);
+	return (crc);
+}
+#endif /* CKSUM_SIMD */
+
+static unsigned int crc32c_select(unsigned int crc, const unsigned char *p, size_t len);
+
+static crc32c_func_t crc32c_func = crc32c_select;
+static const char *crc32c_kernel_name = NULL;
+
+static void
+crc32c_build_table(void)
+{
+	unsigned int i, k, c;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : (c >> 1);
+		crc32c_table[i] = c;
+	}
+}
+
+static void
+crc32c_select_kernel(void)
+{
+	crc32c_func_t func = crc32c_sw;
+	const char *name = "table";
+
+#if CKSUM_SIMD
+	if (cksum_cpu_features() & CPU_HAS_SSE42) {
+		func = crc32c_sse42;
+		name = "sse4.2";
+	}
+#endif
+	if (func == crc32c_sw)
+		crc32c_build_table();
+	crc32c_kernel_name = name;
+	crc32c_func = func;
+}
+
+static unsigned int
+crc32c_select(unsigned int crc, const unsigned char *p, size_t len)
+{
+	crc32c_select_kernel();
+	return (crc32c_func(crc, p, len));
+}
+
+static unsigned int
+crc32c_extend(unsigned int crc, const unsigned char *p, size_t len)
+{
+	return (crc32c_func(crc, p, len));
+}
+
+/* Name of the CRC32C kernel in use: "table" or "sse4.2" */
+const char *
+crc32c_kernel(void)
+{
+	if (crc32c_kernel_name == NULL)
+		crc32c_select_kernel();
+	return (crc32c_kernel_name);
+}
+
+/* Like inet_cksum_set_kernel(), for the CRC32C kernels */
+int
+crc32c_set_kernel(const char *name)
+{
+	if (strcmp(name, "table") == 0) {
+		crc32c_build_table();
+		crc32c_kernel_name = "table";
+		crc32c_func = crc32c_sw;
+		return (0);
+	}
+#if CKSUM_SIMD
+	if (strcmp(name, "sse4.2") == 0 && (cksum_cpu_features() & CPU_HAS_SSE42)) {
+		crc32c_kernel_name = "sse4.2";
+		crc32c_func = crc32c_sse42;
+		return (0);
+	}
+#endif
+	return (-1);
+}
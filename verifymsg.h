@@ -42,11 +42,93 @@
 #ifndef VERIFYMSG_H_INCLUDED
 #define VERIFYMSG_H_INCLUDED
 
+#include <stdio.h>
+
+/* What verify_msg_info() found in a verifiable message's header */
+typedef struct verifiable_msg_info_stct {
+	int version;			/* 1, 2 or 3 (block layout) */
+	unsigned long long sequence;	/* v2: application sequence number */
+	unsigned long long send_ns;	/* v2: send time, ns since the epoch */
+	size_t payload_len;		/* v2: bytes after the header; v1: message length */
+} verifiable_msg_info_t;
+
+/* A damaged byte range found by verify_msg_blocks() */
+typedef struct verifiable_bad_range_stct {
+	size_t offset;			/* First damaged byte, from the start of the message */
+	size_t len;			/* Bytes in the range */
+} verifiable_bad_range_t;
+
+/* Per-thread state for the _r functions (see verifier_ctx_create()) */
+typedef struct verifier_ctx_stct verifier_ctx_t;
+
 size_t minimum_verifiable_msglen(void);
+size_t minimum_verifiable_msglen_v2(void);
+size_t minimum_verifiable_msglen_blocks(void);
+void verifiable_msg_seed(unsigned long long seed);
+double verifiable_msg_gen_rate(size_t msglen);
 int construct_verifiable_msg(char * data, size_t len);
 int construct_verifiable_msgv(const lbm_iovec_t *iov, int count);
+int construct_verifiable_msg_v2(char * data, size_t len, unsigned long long seq);
+int construct_verifiable_msgv_v2(const lbm_iovec_t *iov, int count, unsigned long long seq);
+int construct_verifiable_msg_blocks(char * data, size_t len, unsigned long long seq);
 int verify_msg(const char * Data, size_t Length, int Verbose);
+int verify_msg_header(const char * Data, size_t Length, verifiable_msg_info_t *info);
+int verify_msg_info(const char * Data, size_t Length, int Verbose, verifiable_msg_info_t *info);
+int verify_msg_blocks(const char * Data, size_t Length, verifiable_bad_range_t *ranges, int max_ranges);
+void print_verify_bad_ranges(FILE *fp, const char * Data, size_t Length);
+unsigned long long verifiable_msg_now_ns(void);
+
+verifier_ctx_t *verifier_ctx_create(void);
+void verifier_ctx_delete(verifier_ctx_t *vctx);
+void verifier_ctx_seed(verifier_ctx_t *vctx, unsigned long long seed);
+int construct_verifiable_msg_r(verifier_ctx_t *vctx, char * data, size_t len);
+int construct_verifiable_msgv_r(verifier_ctx_t *vctx, const lbm_iovec_t *iov, int count);
+int construct_verifiable_msg_v2_r(verifier_ctx_t *vctx, char * data, size_t len, unsigned long long seq);
+int construct_verifiable_msgv_v2_r(verifier_ctx_t *vctx, const lbm_iovec_t *iov, int count, unsigned long long seq);
+int construct_verifiable_msg_blocks_r(verifier_ctx_t *vctx, char * data, size_t len, unsigned long long seq);
+int verify_msg_r(verifier_ctx_t *vctx, const char * Data, size_t Length, int Verbose, verifiable_msg_info_t *info);
 unsigned short int inet_cksum(unsigned short int *addr, size_t len);
+unsigned short int inet_cksumv(const lbm_iovec_t *iov, int count);
+const char *inet_cksum_kernel(void);
+int inet_cksum_set_kernel(const char *name);
+const char *crc32c_kernel(void);
+int crc32c_set_kernel(const char *name);
+
+/* A ring of pre-built verifiable messages, laid out in one arena */
+typedef struct verifiable_ring_stct {
+	char *arena;			/* nslots * stride bytes */
+	size_t arena_len;		/* Bytes allocated for the arena */
+	size_t stride;			/* Distance between slots (cache line multiple) */
+	size_t *lens;			/* Message length held in each slot */
+	unsigned int nslots;		/* Number of messages in the ring */
+	unsigned int *crcs;		/* v2: CRC32C state after each slot's payload */
+	unsigned int next;		/* Slot handed out by the next verifiable_ring_next() */
+	int version;			/* Verifiable message version in the slots */
+	int hugepages;			/* 2: hugetlb pages, 1: transparent huge pages, 0: none */
+} verifiable_ring_t;
+
+/* Running state for verifying a message that arrives in pieces */
+#define VERIFY_STREAM_HDR_LEN 32
+typedef struct verify_stream_stct {
+	unsigned long long sum;		/* v1: running ones' complement sum */
+	size_t offset;			/* Bytes of the message added so far */
+	size_t msg_len;			/* v2, v3: total length from the header; 0 until known */
+	size_t hdr_len;			/* v3: header and block table length */
+	unsigned int crc;		/* v2: running CRC32C of the payload; v3: of the block table */
+	unsigned int blk_crc;		/* v3: running CRC32C of the current block */
+	unsigned int blks_crc;		/* v3: running CRC32C of the finished blocks' CRCs */
+	int version;			/* 1, 2 or 3 once the magic number is in, -1 if not verifiable */
+	unsigned char hdr[VERIFY_STREAM_HDR_LEN];	/* First bytes of the message */
+} verify_stream_t;
+
+void verify_stream_init(verify_stream_t *vs);
+size_t verify_stream_update(verify_stream_t *vs, const char *data, size_t len);
+int verify_stream_complete(const verify_stream_t *vs);
+int verify_stream_final(verify_stream_t *vs, int Verbose, verifiable_msg_info_t *info);
+
+int verifiable_ring_create(verifiable_ring_t *ring, unsigned int nslots, const size_t *lens, unsigned int nlens, int version, int hugepages);
+const char *verifiable_ring_next(verifiable_ring_t *ring, size_t *len, unsigned long long seq);
+void verifiable_ring_delete(verifiable_ring_t *ring);
 
 #endif
 